@@ -0,0 +1,40 @@
+# Copyright (C) 2026  gemmaro
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+# Throughput of batch functions from 1 to MAX_THREADS threads.
+#
+#   ENABLE_BENCH=true bin/compile
+#   "$MRUBY_SRC/build/host/bin/mruby" bench/batch.rb [COUNT] [MAX_THREADS]
+
+count = (ARGV[0] || 200_000).to_i
+max_threads = (ARGV[1] || 8).to_i
+strs = Array.new(count) do |i|
+  "HTTP://User@Example.COM:8080/a/./b/../c/#{i}/d%7e?q=#{i}&r=%61#Frag"
+end
+
+def measure(label, threads, count)
+  start = Time.now
+  yield
+  elapsed = Time.now - start
+  puts format("%-16s threads=%-3d %8.3fs %12.0f URIs/s",
+              label, threads, elapsed, count / elapsed)
+end
+
+threads = 1
+while threads <= max_threads
+  measure("parse_many", threads, count) { URIParser.parse_many(strs, threads:) }
+  measure("normalize_many", threads, count) { URIParser.normalize_many(strs, threads:) }
+  threads *= 2
+end
@@ -0,0 +1,40 @@
+# Copyright (C) 2026  gemmaro
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+# Throughput of single-threaded operations, to compare the build
+# linking the system uriparser with the URIPARSER_SOURCE_DIR build.
+#
+#   ENABLE_BENCH=true bin/compile
+#   "$MRUBY_SRC/build/host/bin/mruby" bench/parse.rb [COUNT]
+
+count = (ARGV[0] || 200_000).to_i
+strs = Array.new(count) do |i|
+  "http://user@example.com:8080/a/b/c/#{i}?q=#{i}&r=s#frag"
+end
+uris = strs.map { |str| URIParser.parse(str) }
+
+def measure(label, count)
+  start = Time.now
+  yield
+  elapsed = Time.now - start
+  puts format("%-12s %8.3fs %12.0f ops/s", label, elapsed, count / elapsed)
+end
+
+measure("parse", count) { strs.each { |str| URIParser.parse(str) } }
+measure("getters", count) do
+  uris.each { |uri| uri.scheme; uri.hostname; uri.port; uri.query }
+end
+measure("to_s", count) { uris.each { |uri| uri.to_s } }
+measure("normalize!", count) { uris.each { |uri| uri.normalize! } }
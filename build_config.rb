@@ -2,7 +2,12 @@ MRuby::Build.new do |conf|
   toolchain :gcc
   conf.gem File.expand_path(File.dirname(__FILE__))
   conf.enable_test
-  conf.linker.libraries << 'uriparser'
+  if ENV['URIPARSER_SOURCE_DIR']
+    # Keep the LTO objects of uriparser and this gem visible to the linker.
+    conf.archiver.command = 'gcc-ar'
+  else
+    conf.linker.libraries << 'uriparser'
+  end
 
   if ENV['DEBUG'] == 'true'
     conf.enable_debug
@@ -11,6 +16,19 @@ MRuby::Build.new do |conf|
     conf.gem core: 'mruby-bin-mirb'
   end
 
+  if ENV['SANITIZE'] == 'true'
+    flags = %w[-fsanitize=address,undefined -fno-sanitize-recover=all
+               -fno-omit-frame-pointer -g]
+    conf.cc.flags.concat(flags)
+    conf.linker.flags.concat(flags)
+  end
+
+  if ENV['ENABLE_BENCH'] == 'true'
+    conf.gem core: 'mruby-time'
+    conf.gem core: 'mruby-sprintf'
+    conf.gem core: 'mruby-bin-mruby'
+  end
+
   if ENV['ENABLE_TESTS'] == 'true'
     conf.gem core: 'mruby-io'
     # conf.gem core: 'hal-posix-io'
@@ -32,6 +32,14 @@ module URIParser
       URIParser.parse(str)
     end
 
+    def self.parse_lazy(str)
+      URIParser.parse_lazy(str)
+    end
+
+    def self.load(bytes)
+      URIParser.load(bytes)
+    end
+
     def self.from_filename(filename, windows: false)
       parse(URIParser.filename_to_uri_string(filename, windows:))
     end
@@ -52,6 +52,7 @@
 
 #include <mruby/array.h>
 #include <mruby/boxing_word.h>
+#include <mruby/class.h>
 #include <mruby/data.h>
 #include <mruby/hash.h>
 #include <mruby/presym.h>
@@ -59,9 +60,32 @@
 #include <mruby/value.h>
 #include <mruby/variable.h>
 
+#include <stdlib.h>
+#include <string.h>
+
 /* https://uriparser.github.io/doc/api/latest/ */
 #include <uriparser/Uri.h>
 
+#if defined(_WIN32) && !defined(MRB_URIPARSER_NO_THREADS)
+#define MRB_URIPARSER_NO_THREADS
+#endif
+
+#ifndef MRB_URIPARSER_NO_THREADS
+#include <pthread.h>
+#endif
+
+/* Upper limit of the `threads` option of batch functions.  */
+#ifndef MRB_URIPARSER_MAX_THREADS
+#define MRB_URIPARSER_MAX_THREADS 64
+#endif
+
+/* Least number of strings for each thread of batch functions.  Smaller
+   batches use fewer threads, down to only the calling one, as starting
+   a thread costs more than parsing a few URIs.  */
+#ifndef MRB_URIPARSER_MIN_BATCH_PER_THREAD
+#define MRB_URIPARSER_MIN_BATCH_PER_THREAD 256
+#endif
+
 #define DONE mrb_gc_arena_restore (mrb, 0);
 
 #define MRB_URIPARSER(mrb) mrb_module_get_id (mrb, MRB_SYM (URIParser))
@@ -93,22 +117,25 @@
 
 #define MRB_URIPARSER_PARSE_FAILED "URI parse failed at"
 
+/* All components, as `uri.normalize!` normalizes by default.  */
+#define MRB_URIPARSER_NORMALIZE_ALL                                           \
+  (URI_NORMALIZE_SCHEME | URI_NORMALIZE_USER_INFO | URI_NORMALIZE_HOST        \
+   | URI_NORMALIZE_PATH | URI_NORMALIZE_QUERY | URI_NORMALIZE_FRAGMENT)
+
 #define MRB_URIPARSER_STR_IN_RANGE(mrb, range, field)                         \
   (!range->field.afterLast || !range->field.first)                            \
       ? mrb_nil_value ()                                                      \
       : mrb_str_new (mrb, range->field.first,                                 \
                      range->field.afterLast - range->field.first)
 
-#define MRB_URIPARSER_URI(value) ((mrb_uriparser_data *)DATA_PTR (value))->uri
+/* The URI of the instance, parsing it first if it is lazy.  */
+#define MRB_URIPARSER_URI(value) mrb_uriparser_uri (mrb, value)
+
+#define MRB_URIPARSER_NEW_WITH_TEXT(mrb, uri_val, text_val)                   \
+  return mrb_uriparser_wrap (mrb, uri_val, text_val);
 
 #define MRB_URIPARSER_NEW(mrb, uri_val)                                       \
-  const mrb_value value                                                       \
-      = mrb_obj_new (mrb, MRB_URIPARSER_URI_CLASS (mrb), 0, NULL);            \
-  mrb_uriparser_data *const data                                              \
-      = mrb_malloc (mrb, sizeof (mrb_uriparser_data));                        \
-  data->uri = uri_val;                                                        \
-  mrb_data_init (value, data, &mrb_uriparser_data_type);                      \
-  return value;
+  MRB_URIPARSER_NEW_WITH_TEXT (mrb, uri_val, NULL)
 
 /**
  * Get the specific component of the URI.
@@ -135,8 +162,8 @@
   static mrb_value mrb_uriparser_##component (mrb_state *const mrb,           \
                                               const mrb_value self)           \
   {                                                                           \
-    return MRB_URIPARSER_STR_IN_RANGE (mrb, MRB_URIPARSER_URI (self),         \
-                                       component);                            \
+    const UriUriA *const uri = MRB_URIPARSER_URI (self);                      \
+    return MRB_URIPARSER_STR_IN_RANGE (mrb, uri, component);                  \
   }
 
 /**
@@ -180,16 +207,34 @@
 typedef struct
 {
   /**
-   * Pointer to a `UriUriA` structure representing the parsed URI.
+   * Pointer to a `UriUriA` structure representing the parsed URI, or
+   * `NULL` if the URI is lazy and not parsed yet.
    */
   UriUriA *uri;
+  /**
+   * Buffer owning the text which the ranges of `uri` point into, or
+   * `NULL` when they point elsewhere.  Set by loading a dumped URI, and
+   * holding the source of a lazy URI.
+   */
+  char *text;
 } mrb_uriparser_data;
 
+/* Free the URI, if any, and the text its ranges point into, if any.  */
+static void
+mrb_uriparser_release (mrb_state *const mrb, UriUriA *const uri,
+                       char *const text)
+{
+  if (uri)
+    uriFreeUriMembersA (uri);
+  mrb_free (mrb, uri);
+  mrb_free (mrb, text);
+}
+
 static void
 mrb_uriparser_free (mrb_state *const mrb, void *const p)
 {
   mrb_uriparser_data *const data = p;
-  uriFreeUriMembersA (data->uri);
+  mrb_uriparser_release (mrb, data->uri, data->text);
   mrb_free (mrb, data);
 }
 
@@ -198,6 +243,142 @@ static const struct mrb_data_type mrb_uriparser_data_type = {
   .dfree = mrb_uriparser_free,
 };
 
+/* Wrap the URI, and the text its ranges point into if any, in a new
+   `URIParser::URI` instance which owns them.  */
+static mrb_value
+mrb_uriparser_wrap (mrb_state *const mrb, UriUriA *const uri,
+                    char *const text)
+{
+  struct RClass *const uri_class = MRB_URIPARSER_URI_CLASS (mrb);
+  /* Make the object first, so that the data is never left without an
+     owner.  */
+  const mrb_value value = mrb_obj_value (mrb_data_object_alloc (
+      mrb, uri_class, NULL, &mrb_uriparser_data_type));
+  mrb_uriparser_data *const data
+      = mrb_malloc_simple (mrb, sizeof (mrb_uriparser_data));
+  if (!data)
+    {
+      mrb_uriparser_release (mrb, uri, text);
+      MRB_URIPARSER_RAISE_NOMEM (mrb, "failed to allocate URI");
+    }
+  data->uri = uri;
+  data->text = text;
+  DATA_PTR (value) = data;
+  return value;
+}
+
+/* Get the data of the instance, raising if it is not initialized.  */
+static mrb_uriparser_data *
+mrb_uriparser_data_get (mrb_state *const mrb, const mrb_value value)
+{
+  mrb_uriparser_data *const data
+      = mrb_data_get_ptr (mrb, value, &mrb_uriparser_data_type);
+  /* Neither parsed nor lazy, as left by a failed copy.  */
+  if (!data || (!data->uri && !data->text))
+    MRB_URIPARSER_RAISE (mrb, "uninitialized URI");
+  return data;
+}
+
+/* Parse the source of a lazy URI, pointing the ranges into it.  */
+static int
+mrb_uriparser_parse_text (mrb_state *const mrb,
+                          mrb_uriparser_data *const data,
+                          const char **const error_pos)
+{
+  UriUriA *const uri = mrb_malloc (mrb, sizeof (UriUriA));
+  const int status = uriParseSingleUriA (uri, data->text, error_pos);
+  if (status == URI_SUCCESS)
+    data->uri = uri;
+  else
+    mrb_free (mrb, uri);
+  return status;
+}
+
+static UriUriA *
+mrb_uriparser_uri (mrb_state *const mrb, const mrb_value value)
+{
+  mrb_uriparser_data *const data = mrb_uriparser_data_get (mrb, value);
+  if (data->uri)
+    return data->uri;
+  const char *error_pos;
+  const int status = mrb_uriparser_parse_text (mrb, data, &error_pos);
+  if (status == URI_ERROR_SYNTAX)
+    {
+      mrb_value msg = mrb_format (mrb, "%s: `%s'", MRB_URIPARSER_PARSE_FAILED,
+                                  error_pos);
+      MRB_URIPARSER_RAISE (mrb, RSTRING_PTR (msg));
+    }
+  if (status != URI_SUCCESS)
+    MRB_URIPARSER_RAISE (mrb, "failed to parse");
+  return data->uri;
+}
+
+/* Parse the string into a new `URIParser::URI` instance.  The ranges
+   point into a copy of the string owned by the instance, since the
+   string itself may be collected first.  */
+static mrb_value
+mrb_uriparser_parse_cstr (mrb_state *const mrb, const char *const str)
+{
+  const size_t len = strlen (str);
+  char *const text = mrb_malloc (mrb, len + 1);
+  memcpy (text, str, len + 1);
+  UriUriA *const uri = mrb_malloc_simple (mrb, sizeof (UriUriA));
+  if (!uri)
+    {
+      mrb_free (mrb, text);
+      MRB_URIPARSER_RAISE_NOMEM (mrb, "failed to allocate URI");
+    }
+  const char *error_pos;
+  const int status = uriParseSingleUriExA (uri, text, text + len, &error_pos);
+  if (status != URI_SUCCESS)
+    {
+      mrb_free (mrb, uri);
+      /* Report the position in the string, as the copy is freed.  The
+         position is set only for syntax errors.  */
+      if (status == URI_ERROR_SYNTAX)
+        error_pos = str + (error_pos - text);
+      mrb_free (mrb, text);
+      if (status != URI_ERROR_SYNTAX)
+        MRB_URIPARSER_RAISE (mrb, "failed to parse");
+      mrb_value msg = mrb_format (mrb, "%s: `%s'", MRB_URIPARSER_PARSE_FAILED,
+                                  error_pos);
+      MRB_URIPARSER_RAISE (mrb, RSTRING_PTR (msg));
+    }
+  MRB_URIPARSER_NEW_WITH_TEXT (mrb, uri, text);
+}
+
+static void
+mrb_uriparser_query_list_free (mrb_state *const mrb, void *const p)
+{
+  uriFreeQueryListA (p);
+}
+
+/* Holder of a dissected query list while it is converted.  */
+static const struct mrb_data_type mrb_uriparser_query_list_type = {
+  .struct_name = "mrb_uriparser_query_list_type",
+  .dfree = mrb_uriparser_query_list_free,
+};
+
+/* Resolve the relative URI against the base into a new URI which owns
+   its texts, as the result of uriAddBaseUriA points into both.  */
+static UriUriA *
+mrb_uriparser_resolve (mrb_state *const mrb, const UriUriA *const rel,
+                       const UriUriA *const base)
+{
+  UriUriA *const resolved = mrb_malloc (mrb, sizeof (UriUriA));
+  if (uriAddBaseUriA (resolved, rel, base) != URI_SUCCESS)
+    {
+      mrb_free (mrb, resolved);
+      MRB_URIPARSER_RAISE (mrb, "failed to resolve URI");
+    }
+  if (uriMakeOwnerA (resolved) != URI_SUCCESS)
+    {
+      mrb_uriparser_release (mrb, resolved, NULL);
+      MRB_URIPARSER_RAISE_NOMEM (mrb, "failed to own URI");
+    }
+  return resolved;
+}
+
 /* initialized functions */
 
 /**
@@ -218,16 +399,131 @@ mrb_uriparser_parse (mrb_state *const mrb, const mrb_value self)
 {
   const char *str = NULL;
   mrb_get_args (mrb, "z", &str);
+  return mrb_uriparser_parse_cstr (mrb, str);
+}
+
+/**
+ * @brief Make a URI object which parses the string when needed.
+ *
+ * ```ruby
+ * URIParser.parse_lazy(str)
+ * URIParser::URI.parse_lazy(str)
+ * ```
+ *
+ * where `str` is a URI string.  The string is parsed on the first
+ * access to the components, which raises `URIParser::Error` if it is
+ * invalid.  `uri.to_s` returns the string without parsing it.
+ *
+ * @return `URIParser::URI` instance.
+ * @sa mrb_uriparser_parse
+ * @sa mrb_uriparser_valid
+ */
+static mrb_value
+mrb_uriparser_parse_lazy (mrb_state *const mrb, const mrb_value self)
+{
+  const char *str = NULL;
+  mrb_get_args (mrb, "z", &str);
+  const size_t len = strlen (str);
+  char *const text = mrb_malloc (mrb, len + 1);
+  memcpy (text, str, len + 1);
+  MRB_URIPARSER_NEW_WITH_TEXT (mrb, NULL, text);
+}
 
-  UriUriA *const uri = mrb_malloc (mrb, sizeof (UriUriA));
+/**
+ * @brief Check if the URI is parsed.
+ *
+ * ```ruby
+ * uri.parsed?
+ * ```
+ *
+ * where `uri` is a `URIParser::URI` instance.
+ *
+ * @return Boolean, which is false only for lazy URIs not parsed yet.
+ * @sa mrb_uriparser_parse_lazy
+ */
+static mrb_value
+mrb_uriparser_parsed (mrb_state *const mrb, const mrb_value self)
+{
+  const mrb_uriparser_data *const data = mrb_uriparser_data_get (mrb, self);
+  return mrb_bool_value (data->uri != NULL);
+}
+
+/**
+ * @brief Check if the URI is valid.
+ *
+ * ```ruby
+ * uri.valid?
+ * ```
+ *
+ * where `uri` is a `URIParser::URI` instance.  A lazy URI is parsed
+ * here, and is kept parsed if it is valid.  This is a full parse which
+ * allocates the path segments and keeps them, not a cheaper check.
+ *
+ * @return Boolean.
+ * @sa mrb_uriparser_parse_lazy
+ */
+static mrb_value
+mrb_uriparser_valid (mrb_state *const mrb, const mrb_value self)
+{
+  mrb_uriparser_data *const data = mrb_uriparser_data_get (mrb, self);
   const char *error_pos;
-  if (uriParseSingleUriA (uri, str, &error_pos) != URI_SUCCESS)
+  return mrb_bool_value (data->uri
+                         || mrb_uriparser_parse_text (mrb, data, &error_pos)
+                                == URI_SUCCESS);
+}
+
+static size_t
+mrb_uriparser_range_size (const UriTextRangeA *const range)
+{
+  return range->first ? (size_t)(range->afterLast - range->first) : 0;
+}
+
+/**
+ * @brief Get the native memory held by the URI.
+ *
+ * ```ruby
+ * uri.memsize
+ * ```
+ *
+ * where `uri` is a `URIParser::URI` instance.  The size covers the
+ * structures allocated outside of the mruby heap objects, i.e. the parse
+ * result, its path segments and host data, and the text its ranges point
+ * into.
+ *
+ * @return Integer of bytes.
+ */
+static mrb_value
+mrb_uriparser_memsize (mrb_state *const mrb, const mrb_value self)
+{
+  const mrb_uriparser_data *const data = mrb_uriparser_data_get (mrb, self);
+  size_t size = sizeof (mrb_uriparser_data);
+  if (data->text)
+    size += strlen (data->text) + 1;
+  const UriUriA *const uri = data->uri;
+  if (!uri)
+    return mrb_int_value (mrb, (mrb_int)size);
+
+  size += sizeof (UriUriA);
+  if (uri->hostData.ip4)
+    size += sizeof (UriIp4);
+  if (uri->hostData.ip6)
+    size += sizeof (UriIp6);
+  for (const UriPathSegmentA *segment = uri->pathHead; segment;
+       segment = segment->next)
     {
-      mrb_value msg = mrb_format (mrb, "%s: `%s'", MRB_URIPARSER_PARSE_FAILED,
-                                  error_pos);
-      MRB_URIPARSER_RAISE (mrb, RSTRING_PTR (msg));
+      size += sizeof (UriPathSegmentA);
+      if (uri->owner)
+        size += mrb_uriparser_range_size (&segment->text);
     }
-  MRB_URIPARSER_NEW (mrb, uri);
+  if (uri->owner)
+    {
+      const UriTextRangeA *const ranges[]
+          = { &uri->scheme,   &uri->userInfo, &uri->hostText,
+              &uri->portText, &uri->query,    &uri->fragment };
+      for (size_t index = 0; index < sizeof ranges / sizeof *ranges; index++)
+        size += mrb_uriparser_range_size (ranges[index]);
+    }
+  return mrb_int_value (mrb, (mrb_int)size);
 }
 
 /**
@@ -262,18 +558,16 @@ mrb_uriparser_filename_to_uri_string (mrb_state *const mrb,
   if (mrb_undef_p (kw_values[0]))
     kw_values[0] = mrb_false_value ();
   const mrb_bool windows = mrb_test (kw_values[0]);
-  char *const abs_uri = mrb_malloc (
-      mrb, ((windows ? 8 : 7 /* Unix */) + 3 * abs_filename_len + 1)
-               * sizeof (char));
+  /* Convert into the string itself, which has room for the zero
+     terminator.  */
+  const mrb_value uri = mrb_str_new (
+      mrb, NULL, (windows ? 8 : 7 /* Unix */) + 3 * abs_filename_len);
+  char *const abs_uri = RSTRING_PTR (uri);
   if ((windows ? uriWindowsFilenameToUriStringA (abs_filename, abs_uri)
                : uriUnixFilenameToUriStringA (abs_filename, abs_uri))
       != URI_SUCCESS)
-    {
-      mrb_free (mrb, abs_uri);
-      MRB_URIPARSER_RAISE (mrb, "failed to convert to URI");
-    }
-  const mrb_value uri = mrb_str_new_cstr (mrb, abs_uri);
-  mrb_free (mrb, abs_uri);
+    MRB_URIPARSER_RAISE (mrb, "failed to convert to URI");
+  mrb_str_resize (mrb, uri, strlen (abs_uri));
   return uri;
 }
 
@@ -314,17 +608,15 @@ mrb_uriparser_uri_string_to_filename (mrb_state *const mrb,
   if (mrb_undef_p (kw_values[0]))
     kw_values[0] = mrb_false_value ();
   const mrb_bool windows = mrb_test (kw_values[0]);
-  char *const abs_filename = mrb_malloc (
-      mrb, (abs_uri_len + 1 - (windows ? 8 : 7 /* Unix */)) * sizeof (char));
+  /* Convert into the string itself.  The filename is never longer than
+     the URI, and the string has room for the zero terminator.  */
+  const mrb_value filename = mrb_str_new (mrb, NULL, abs_uri_len);
+  char *const abs_filename = RSTRING_PTR (filename);
   if ((windows ? uriUriStringToWindowsFilenameA (abs_uri, abs_filename)
                : uriUriStringToUnixFilenameA (abs_uri, abs_filename))
       != URI_SUCCESS)
-    {
-      mrb_free (mrb, abs_filename);
-      MRB_URIPARSER_RAISE (mrb, "failed to convert to filename");
-    }
-  const mrb_value filename = mrb_str_new_cstr (mrb, abs_filename);
-  mrb_free (mrb, abs_filename);
+    MRB_URIPARSER_RAISE (mrb, "failed to convert to filename");
+  mrb_str_resize (mrb, filename, strlen (abs_filename));
   return filename;
 }
 
@@ -346,35 +638,50 @@ mrb_uriparser_uri_string_to_filename (mrb_state *const mrb,
 static mrb_value
 mrb_uriparser_compose_query (mrb_state *const mrb, const mrb_value self)
 {
-  UriQueryListA *query_list = NULL;
   mrb_value ary;
   mrb_get_args (mrb, "A", &ary);
-  for (mrb_int index = RARRAY_LEN (ary) - 1; index >= 0; index--)
+  const mrb_int len = RARRAY_LEN (ary);
+  /* Check the entries first, so that the list below can point into them
+     as C strings.  */
+  for (mrb_int index = 0; index < len; index++)
     {
-      UriQueryListA *current = mrb_malloc (mrb, sizeof (UriQueryListA));
-      current->next = query_list;
-      mrb_value entry = mrb_ary_ref (mrb, ary, index);
-      current->key = mrb_str_to_cstr (mrb, mrb_ary_ref (mrb, entry, 0));
-
-      mrb_value value = mrb_ary_ref (mrb, entry, 1);
-      current->value = mrb_nil_p (value) ? NULL : mrb_str_to_cstr (mrb, value);
+      const mrb_value entry
+          = mrb_ensure_array_type (mrb, RARRAY_PTR (ary)[index]);
+      mrb_string_cstr (mrb, mrb_ary_ref (mrb, entry, 0));
+      const mrb_value value = mrb_ary_ref (mrb, entry, 1);
+      if (!mrb_nil_p (value))
+        mrb_string_cstr (mrb, value);
+    }
+  if (len == 0)
+    return mrb_str_new (mrb, NULL, 0);
 
-      query_list = current;
+  /* The list lives in a string buffer, so that the GC drops it even if
+     composing raises.  */
+  const mrb_value nodes
+      = mrb_str_new (mrb, NULL, len * sizeof (UriQueryListA));
+  UriQueryListA *const query_list = (UriQueryListA *)RSTRING_PTR (nodes);
+  for (mrb_int index = 0; index < len; index++)
+    {
+      const mrb_value entry = RARRAY_PTR (ary)[index];
+      const mrb_value value = mrb_ary_ref (mrb, entry, 1);
+      query_list[index] = (UriQueryListA){
+        .key = RSTRING_PTR (mrb_ary_ref (mrb, entry, 0)),
+        .value = mrb_nil_p (value) ? NULL : RSTRING_PTR (value),
+        .next = index + 1 < len ? &query_list[index + 1] : NULL,
+      };
     }
   int chars_required;
-  char *query_string;
   if (uriComposeQueryCharsRequiredA (query_list, &chars_required)
       != URI_SUCCESS)
     MRB_URIPARSER_RAISE (
         mrb, "failed to calculate characters required to compose query");
-  query_string = mrb_malloc (mrb, (chars_required + 1) * sizeof (char));
   int chars_written;
-  if (uriComposeQueryA (query_string, query_list, chars_required + 1,
+  const mrb_value str = mrb_str_new (mrb, NULL, chars_required);
+  if (uriComposeQueryA (RSTRING_PTR (str), query_list, chars_required + 1,
                         &chars_written)
       != URI_SUCCESS)
     MRB_URIPARSER_RAISE (mrb, "failed to compose query");
-  mrb_value str = mrb_str_new (mrb, query_string, chars_written - 1);
-  mrb_free (mrb, query_string);
+  mrb_str_resize (mrb, str, chars_written - 1);
   return str;
 }
 
@@ -395,12 +702,43 @@ mrb_uriparser_initialize_copy (mrb_state *const mrb, const mrb_value self)
 {
   mrb_value original;
   mrb_get_args (mrb, "o", &original);
-  UriUriA *const new_uri = mrb_malloc (mrb, sizeof (UriUriA));
-  if (uriCopyUriA (new_uri, MRB_URIPARSER_URI (original)))
-    MRB_URIPARSER_RAISE (mrb, "failed to copy URI");
-  mrb_uriparser_data *data = mrb_malloc (mrb, sizeof (mrb_uriparser_data));
+  const mrb_uriparser_data *const original_data
+      = mrb_uriparser_data_get (mrb, original);
+  if (original_data == DATA_PTR (self))
+    return self;
+
+  mrb_uriparser_data *data = DATA_PTR (self);
+  if (!data)
+    {
+      data = mrb_malloc (mrb, sizeof (mrb_uriparser_data));
+      data->uri = NULL;
+      data->text = NULL;
+      mrb_data_init (self, data, &mrb_uriparser_data_type);
+    }
+
+  /* Copy before releasing, so that a failed copy leaves the receiver
+     as it was.  */
+  UriUriA *new_uri = NULL;
+  char *new_text = NULL;
+  if (!original_data->uri)
+    {
+      /* Stay lazy.  */
+      const size_t len = strlen (original_data->text);
+      new_text = mrb_malloc (mrb, len + 1);
+      memcpy (new_text, original_data->text, len + 1);
+    }
+  else
+    {
+      new_uri = mrb_malloc (mrb, sizeof (UriUriA));
+      if (uriCopyUriA (new_uri, original_data->uri) != URI_SUCCESS)
+        {
+          mrb_free (mrb, new_uri);
+          MRB_URIPARSER_RAISE (mrb, "failed to copy URI");
+        }
+    }
+  mrb_uriparser_release (mrb, data->uri, data->text);
   data->uri = new_uri;
-  mrb_data_init (self, data, &mrb_uriparser_data_type);
+  data->text = new_text;
   return self;
 }
 
@@ -411,15 +749,18 @@ mrb_uriparser_initialize_copy (mrb_state *const mrb, const mrb_value self)
  * uri == another_uri
  * ```
  *
- * where `uri` and `another_uri` are `URIParser::URI` instances.
+ * where `uri` is a `URIParser::URI` instance.
  *
- * @return Boolean.
+ * @return Boolean, which is false if `another_uri` is not a
+ * `URIParser::URI` instance.
  */
 static mrb_value
 mrb_uriparser_equals (mrb_state *const mrb, const mrb_value self)
 {
   mrb_value another;
   mrb_get_args (mrb, "o", &another);
+  if (!mrb_data_get_ptr (mrb, another, &mrb_uriparser_data_type))
+    return mrb_false_value ();
   return mrb_bool_value (
       uriEqualsUriA (MRB_URIPARSER_URI (self), MRB_URIPARSER_URI (another)));
 }
@@ -525,16 +866,19 @@ mrb_uriparser_absolute_path (mrb_state *const mrb, const mrb_value self)
 static mrb_value
 mrb_uriparser_recompose (mrb_state *const mrb, const mrb_value self)
 {
-  const mrb_uriparser_data *const data = DATA_PTR (self);
+  const mrb_uriparser_data *const data = mrb_uriparser_data_get (mrb, self);
+  if (!data->uri)
+    return mrb_str_new_cstr (mrb, data->text); /* lazy */
   int chars_required;
   if (uriToStringCharsRequiredA (data->uri, &chars_required) != URI_SUCCESS)
     MRB_URIPARSER_RAISE (mrb, "could not calculate chars required");
-  chars_required++; /* zero terminator */
-  char *const uri_string = mrb_malloc (mrb, chars_required * sizeof (char));
-  if (uriToStringA (uri_string, data->uri, chars_required, NULL)
+  /* Recompose into the string itself, which has room for the zero
+     terminator.  */
+  const mrb_value str = mrb_str_new (mrb, NULL, chars_required);
+  if (uriToStringA (RSTRING_PTR (str), data->uri, chars_required + 1, NULL)
       != URI_SUCCESS)
     MRB_URIPARSER_RAISE (mrb, "URI recomposing failed");
-  return mrb_str_new_cstr (mrb, uri_string);
+  return str;
 }
 
 /**
@@ -560,13 +904,14 @@ mrb_uriparser_merge_mutably (mrb_state *const mrb, const mrb_value self)
   if (!mrb_obj_is_kind_of (mrb, rel, MRB_URIPARSER_URI_CLASS (mrb)))
     MRB_URIPARSER_RAISE (mrb, "relative URI is expected to be URIParser::URI");
 
-  UriUriA *const resolved = mrb_malloc (mrb, sizeof (UriUriA));
+  const UriUriA *const rel_uri = MRB_URIPARSER_URI (rel);
+  UriUriA *const base_uri = MRB_URIPARSER_URI (self);
+  UriUriA *const resolved
+      = mrb_uriparser_resolve (mrb, rel_uri, base_uri);
   mrb_uriparser_data *const data = DATA_PTR (self);
-  if (uriAddBaseUriA (resolved, MRB_URIPARSER_URI (rel), data->uri)
-      != URI_SUCCESS)
-    MRB_URIPARSER_RAISE (mrb, "failed to resolve URI");
-  mrb_free (mrb, data->uri);
+  mrb_uriparser_release (mrb, data->uri, data->text);
   data->uri = resolved;
+  data->text = NULL;
   return self;
 }
 
@@ -595,12 +940,9 @@ mrb_uriparser_merge (mrb_state *const mrb, const mrb_value self)
   if (!mrb_obj_is_kind_of (mrb, rel, MRB_URIPARSER_URI_CLASS (mrb)))
     MRB_URIPARSER_RAISE (mrb, "relative URI is expected to be URIParser::URI");
 
-  UriUriA *const resolved = mrb_malloc (mrb, sizeof (UriUriA));
-  if (uriAddBaseUriA (resolved, MRB_URIPARSER_URI (rel),
-                      MRB_URIPARSER_URI (self))
-      != URI_SUCCESS)
-    MRB_URIPARSER_RAISE (mrb, "failed to resolve URI");
-  MRB_URIPARSER_NEW (mrb, resolved);
+  const UriUriA *const rel_uri = MRB_URIPARSER_URI (rel);
+  const UriUriA *const base_uri = MRB_URIPARSER_URI (self);
+  MRB_URIPARSER_NEW (mrb, mrb_uriparser_resolve (mrb, rel_uri, base_uri));
 }
 
 /**
@@ -636,15 +978,185 @@ mrb_uriparser_create_reference (mrb_state *const mrb, const mrb_value self)
     values[0] = mrb_false_value ();
   if (!mrb_obj_is_kind_of (mrb, base, MRB_URIPARSER_URI_CLASS (mrb)))
     MRB_URIPARSER_RAISE (mrb, "base URI is expected to be URIParser::URI");
+  const UriUriA *const uri = MRB_URIPARSER_URI (self);
+  const UriUriA *const base_uri = MRB_URIPARSER_URI (base);
   UriUriA *const dest = mrb_malloc (mrb, sizeof (UriUriA));
-  if (uriRemoveBaseUriA (dest, MRB_URIPARSER_URI (self),
-                         MRB_URIPARSER_URI (base),
+  if (uriRemoveBaseUriA (dest, uri, base_uri,
                          mrb_test (values[0]) ? URI_TRUE : URI_FALSE)
       != URI_SUCCESS)
-    MRB_URIPARSER_RAISE (mrb, "failed to remove base URI");
+    {
+      mrb_free (mrb, dest);
+      MRB_URIPARSER_RAISE (mrb, "failed to remove base URI");
+    }
+  /* The result points into the texts of both URIs.  */
+  if (uriMakeOwnerA (dest) != URI_SUCCESS)
+    {
+      mrb_uriparser_release (mrb, dest, NULL);
+      MRB_URIPARSER_RAISE_NOMEM (mrb, "failed to own URI");
+    }
   MRB_URIPARSER_NEW (mrb, dest);
 }
 
+/**
+ * @brief Create relative references to many URIs from this base URI.
+ *
+ * ```ruby
+ * base.route_all(targets, domain_root: false, as: :string)
+ * ```
+ *
+ * where `base` is a `URIParser::URI` instance and `targets` is `Array` of
+ * URI strings or `URIParser::URI` instances.  Same as
+ * `target.route_from(base, domain_root:)` for each target, but string
+ * targets are parsed only for the call, and the references are
+ * recomposed into one buffer.  If `as` is `:uri`, returns
+ * `URIParser::URI` instances instead of strings.
+ *
+ * @return `Array` of relative reference strings or `URIParser::URI`
+ * instances.
+ * @sa mrb_uriparser_create_reference
+ */
+static mrb_value
+mrb_uriparser_route_all (mrb_state *const mrb, const mrb_value self)
+{
+  mrb_value targets;
+  const mrb_int kw_num = 2;
+  const mrb_sym kw_keys[] = { MRB_SYM (domain_root), MRB_SYM (as) };
+  mrb_value kw_values[kw_num];
+  const mrb_kwargs kwargs = { .num = kw_num,
+                              .required = 0,
+                              .rest = NULL,
+                              .table = kw_keys,
+                              .values = kw_values };
+  mrb_get_args (mrb, "A:", &targets, &kwargs);
+  const UriBool domain_root
+      = !mrb_undef_p (kw_values[0]) && mrb_test (kw_values[0]) ? URI_TRUE
+                                                              : URI_FALSE;
+  mrb_bool as_uri = FALSE;
+  if (!mrb_undef_p (kw_values[1]))
+    {
+      const mrb_sym as = mrb_symbol_p (kw_values[1])
+                             ? mrb_symbol (kw_values[1])
+                             : 0;
+      if (as == MRB_SYM (uri))
+        as_uri = TRUE;
+      else if (as != MRB_SYM (string))
+        mrb_raise (mrb, E_ARGUMENT_ERROR, "as must be :string or :uri");
+    }
+
+  const UriUriA *const base_uri = MRB_URIPARSER_URI (self);
+  struct RClass *const uri_class = MRB_URIPARSER_URI_CLASS (mrb);
+  const mrb_int len = RARRAY_LEN (targets);
+  /* Check the targets first, parsing lazy ones, so that the loop below
+     raises only after freeing the URIs it holds.  */
+  for (mrb_int index = 0; index < len; index++)
+    {
+      const mrb_value target = RARRAY_PTR (targets)[index];
+      if (mrb_string_p (target))
+        mrb_string_cstr (mrb, target);
+      else if (mrb_obj_is_kind_of (mrb, target, uri_class))
+        MRB_URIPARSER_URI (target);
+      else
+        MRB_URIPARSER_RAISE (
+            mrb, "target URI is expected to be String or URIParser::URI");
+    }
+
+  const mrb_value result = mrb_ary_new_capa (mrb, len);
+  mrb_value buf = mrb_str_new (mrb, NULL, 64);
+  for (mrb_int index = 0; index < len; index++)
+    {
+      const int ai = mrb_gc_arena_save (mrb);
+      const mrb_value target = RARRAY_PTR (targets)[index];
+      const mrb_bool parse = mrb_string_p (target);
+      UriUriA parsed;
+      const UriUriA *target_uri;
+      if (parse)
+        {
+          const char *error_pos;
+          const int status = uriParseSingleUriExA (
+              &parsed, RSTRING_PTR (target), RSTRING_END (target),
+              &error_pos);
+          if (status == URI_ERROR_SYNTAX)
+            {
+              mrb_value msg = mrb_format (
+                  mrb, "%s: `%s'", MRB_URIPARSER_PARSE_FAILED, error_pos);
+              MRB_URIPARSER_RAISE (mrb, RSTRING_PTR (msg));
+            }
+          if (status != URI_SUCCESS)
+            MRB_URIPARSER_RAISE (mrb, "failed to parse");
+          target_uri = &parsed;
+        }
+      else
+        target_uri = MRB_URIPARSER_URI (target);
+
+      /* The reference points into both the target and the base.  */
+      UriUriA dest;
+      int status = uriRemoveBaseUriA (&dest, target_uri, base_uri,
+                                      domain_root);
+      if (status != URI_SUCCESS)
+        {
+          if (parse)
+            uriFreeUriMembersA (&parsed);
+          MRB_URIPARSER_RAISE (mrb, "failed to remove base URI");
+        }
+
+      if (as_uri)
+        {
+          UriUriA *const routed = mrb_malloc_simple (mrb, sizeof (UriUriA));
+          if (routed)
+            {
+              *routed = dest;
+              status = uriMakeOwnerA (routed);
+            }
+          else
+            status = URI_ERROR_MALLOC;
+          if (parse)
+            uriFreeUriMembersA (&parsed);
+          if (status != URI_SUCCESS)
+            {
+              if (routed)
+                mrb_uriparser_release (mrb, routed, NULL);
+              else
+                uriFreeUriMembersA (&dest);
+              MRB_URIPARSER_RAISE_NOMEM (mrb, "failed to own URI");
+            }
+          mrb_ary_push (mrb, result, mrb_uriparser_wrap (mrb, routed, NULL));
+          mrb_gc_arena_restore (mrb, ai);
+          continue;
+        }
+
+      int chars_required;
+      status = uriToStringCharsRequiredA (&dest, &chars_required);
+      if (status == URI_SUCCESS && RSTRING_LEN (buf) < chars_required)
+        {
+          /* Growing the buffer may raise, so free the URIs first and
+             route the target again.  The buffer at least doubles, so
+             this happens only a few times.  */
+          uriFreeUriMembersA (&dest);
+          if (parse)
+            uriFreeUriMembersA (&parsed);
+          const mrb_int doubled = 2 * RSTRING_LEN (buf);
+          mrb_str_resize (mrb, buf,
+                          chars_required > doubled ? chars_required
+                                                   : doubled);
+          mrb_gc_arena_restore (mrb, ai);
+          index--;
+          continue;
+        }
+      if (status == URI_SUCCESS)
+        status = uriToStringA (RSTRING_PTR (buf), &dest, chars_required + 1,
+                               NULL);
+      uriFreeUriMembersA (&dest);
+      if (parse)
+        uriFreeUriMembersA (&parsed);
+      if (status != URI_SUCCESS)
+        MRB_URIPARSER_RAISE (mrb, "URI recomposing failed");
+      mrb_ary_push (mrb, result,
+                    mrb_str_new (mrb, RSTRING_PTR (buf), chars_required));
+      mrb_gc_arena_restore (mrb, ai);
+    }
+  return result;
+}
+
 /**
  * @brief Normalize URI components in place.
  *
@@ -716,96 +1228,1489 @@ mrb_uriparser_normalize (mrb_state *const mrb, const mrb_value self)
 static mrb_value
 mrb_uriparser_dissect_query (mrb_state *const mrb, const mrb_value self)
 {
-  const mrb_uriparser_data *const data = DATA_PTR (self);
+  const UriUriA *const uri = MRB_URIPARSER_URI (self);
+  /* The holder owns the list, so that raising while building the array
+     frees it.  */
+  const mrb_value holder = mrb_obj_value (mrb_data_object_alloc (
+      mrb, mrb->object_class, NULL, &mrb_uriparser_query_list_type));
   UriQueryListA *query_list;
   int item_count;
-  if (uriDissectQueryMallocA (&query_list, &item_count, data->uri->query.first,
-                              data->uri->query.afterLast)
+  if (uriDissectQueryMallocA (&query_list, &item_count, uri->query.first,
+                              uri->query.afterLast)
       != URI_SUCCESS)
     MRB_URIPARSER_RAISE (mrb, "failed to dissect query");
-  mrb_value ary = mrb_ary_new (mrb);
-  while (query_list)
+  DATA_PTR (holder) = query_list;
+  mrb_value ary = mrb_ary_new_capa (mrb, item_count);
+  for (const UriQueryListA *item = query_list; item; item = item->next)
     {
-      mrb_value entry = mrb_ary_new (mrb);
-      mrb_ary_push (mrb, entry, mrb_str_new_cstr (mrb, query_list->key));
+      mrb_value entry = mrb_ary_new_capa (mrb, 2);
+      mrb_ary_push (mrb, entry, mrb_str_new_cstr (mrb, item->key));
       mrb_ary_push (mrb, entry,
-                    query_list->value
-                        ? mrb_str_new_cstr (mrb, query_list->value)
-                        : mrb_nil_value ());
+                    item->value ? mrb_str_new_cstr (mrb, item->value)
+                                : mrb_nil_value ());
       mrb_ary_push (mrb, ary, entry);
-      query_list = query_list->next;
     }
   uriFreeQueryListA (query_list);
+  DATA_PTR (holder) = NULL;
   return ary;
 }
 
-void
-mrb_mruby_uriparser_gem_init (mrb_state *const mrb)
+/**
+ * @brief A `key=value` pair in a query string.
+ */
+typedef struct
 {
-  /* C have to define classes here before Ruby does. */
-  struct RClass *const uriparser
-      = mrb_define_module_id (mrb, MRB_SYM (URIParser));
-  mrb_define_module_function_id (mrb, uriparser, MRB_SYM (parse),
-                                 mrb_uriparser_parse, MRB_ARGS_REQ (1));
-  mrb_define_module_function_id (
-      mrb, uriparser, MRB_SYM (filename_to_uri_string),
-      mrb_uriparser_filename_to_uri_string, MRB_ARGS_ANY ());
-  mrb_define_module_function_id (
-      mrb, uriparser, MRB_SYM (uri_string_to_filename),
-      mrb_uriparser_uri_string_to_filename, MRB_ARGS_ANY ());
-  mrb_define_module_function_id (mrb, uriparser, MRB_SYM (encode_www_form),
-                                 mrb_uriparser_compose_query,
-                                 MRB_ARGS_REQ (1));
-  struct RClass *const uri = mrb_define_class_under_id (
-      mrb, uriparser, MRB_SYM (URI), mrb->object_class);
-  mrb_define_method_id (mrb, uri, MRB_SYM (initialize_copy),
-                        mrb_uriparser_initialize_copy, MRB_ARGS_REQ (1));
-  mrb_define_method_id (mrb, uri, MRB_OPSYM (eq), mrb_uriparser_equals,
-                        MRB_ARGS_REQ (1));
-  mrb_define_method_id (mrb, uri, MRB_SYM (scheme), mrb_uriparser_scheme,
-                        MRB_ARGS_NONE ());
-  mrb_define_method_id (mrb, uri, MRB_SYM_E (scheme), mrb_uriparser_set_Scheme,
-                        MRB_ARGS_REQ (1));
-  mrb_define_method_id (mrb, uri, MRB_SYM (userinfo), mrb_uriparser_userInfo,
-                        MRB_ARGS_NONE ());
-  mrb_define_method_id (mrb, uri, MRB_SYM_E (userinfo),
-                        mrb_uriparser_set_UserInfo, MRB_ARGS_REQ (1));
-  mrb_define_method_id (mrb, uri, MRB_SYM (hostname), mrb_uriparser_hostText,
-                        MRB_ARGS_NONE ());
-  mrb_define_method_id (mrb, uri, MRB_SYM_E (host), mrb_uriparser_set_HostAuto,
-                        MRB_ARGS_REQ (1));
-  mrb_define_method_id (mrb, uri, MRB_SYM_Q (host), mrb_uriparser_has_host,
-                        MRB_ARGS_NONE ());
-  mrb_define_method_id (mrb, uri, MRB_SYM (port), mrb_uriparser_portText,
-                        MRB_ARGS_NONE ());
-  mrb_define_method_id (mrb, uri, MRB_SYM_E (port), mrb_uriparser_set_PortText,
-                        MRB_ARGS_REQ (1));
-  mrb_define_method_id (mrb, uri, MRB_SYM (path_segments),
-                        mrb_uriparser_path_segments, MRB_ARGS_NONE ());
-  mrb_define_method_id (mrb, uri, MRB_SYM_E (path), mrb_uriparser_set_Path,
-                        MRB_ARGS_REQ (1));
-  mrb_define_method_id (mrb, uri, MRB_SYM (query), mrb_uriparser_query,
-                        MRB_ARGS_NONE ());
-  mrb_define_method_id (mrb, uri, MRB_SYM_E (query), mrb_uriparser_set_Query,
-                        MRB_ARGS_REQ (1));
-  mrb_define_method_id (mrb, uri, MRB_SYM (fragment), mrb_uriparser_fragment,
-                        MRB_ARGS_NONE ());
-  mrb_define_method_id (mrb, uri, MRB_SYM_E (fragment),
-                        mrb_uriparser_set_Fragment, MRB_ARGS_REQ (1));
-  mrb_define_method_id (mrb, uri, MRB_SYM_Q (absolute_path),
-                        mrb_uriparser_absolute_path, MRB_ARGS_NONE ());
-  mrb_define_method_id (mrb, uri, MRB_SYM (to_s), mrb_uriparser_recompose,
-                        MRB_ARGS_NONE ());
-  mrb_define_method_id (mrb, uri, MRB_SYM_B (merge),
-                        mrb_uriparser_merge_mutably, MRB_ARGS_REQ (1));
-  mrb_define_method_id (mrb, uri, MRB_SYM (merge), mrb_uriparser_merge,
-                        MRB_ARGS_REQ (1));
-  mrb_define_method_id (mrb, uri, MRB_SYM (route_from),
-                        mrb_uriparser_create_reference, MRB_ARGS_ANY ());
-  mrb_define_method_id (mrb, uri, MRB_SYM_B (normalize),
-                        mrb_uriparser_normalize, MRB_ARGS_KEY (6, 0));
-  mrb_define_method_id (mrb, uri, MRB_SYM (decode_www_form),
-                        mrb_uriparser_dissect_query, MRB_ARGS_NONE ());
+  /** Whole pair. */
+  UriTextRangeA pair;
+  /** Key, still escaped. */
+  UriTextRangeA key;
+  /** Value, still escaped.  `first` is `NULL` if there is no `=`. */
+  UriTextRangeA value;
+} mrb_uriparser_query_pair;
+
+/* Read the next non-empty pair of the query from `*cur` up to `end`,
+   splitting on `&` as uriDissectQueryMallocA does.  */
+static mrb_bool
+mrb_uriparser_query_next (const char **const cur, const char *const end,
+                          mrb_uriparser_query_pair *const pair)
+{
+  const char *p = *cur;
+  while (p < end && *p == '&')
+    p++;
+  if (p >= end)
+    return FALSE;
+  pair->pair.first = pair->key.first = p;
+  pair->value.first = pair->value.afterLast = NULL;
+  for (; p < end && *p != '&'; p++)
+    if (*p == '=' && !pair->value.first)
+      {
+        pair->key.afterLast = p;
+        pair->value.first = p + 1;
+      }
+  pair->pair.afterLast = p;
+  if (pair->value.first)
+    pair->value.afterLast = p;
+  else
+    pair->key.afterLast = p;
+  *cur = p;
+  return TRUE;
+}
+
+/* Whether the escaped key of the pair decodes to `key`.  Keys which
+   need no decoding are compared in place, others are decoded into
+   `scratch`, which has room for the whole query.  */
+static mrb_bool
+mrb_uriparser_query_key_equals (const mrb_uriparser_query_pair *const pair,
+                                char *const scratch, const char *const key,
+                                const size_t key_len)
+{
+  const char *const first = pair->key.first;
+  const size_t len = pair->key.afterLast - first;
+  if (!memchr (first, '%', len) && !memchr (first, '+', len))
+    return len == key_len && memcmp (first, key, len) == 0;
+  if (len < key_len)
+    return FALSE; /* decoding never makes it longer */
+  memcpy (scratch, first, len);
+  scratch[len] = '\0';
+  const char *const decoded_end
+      = uriUnescapeInPlaceExA (scratch, URI_TRUE, URI_BR_DONT_TOUCH);
+  return (size_t)(decoded_end - scratch) == key_len
+         && memcmp (scratch, key, key_len) == 0;
+}
+
+/* Decode an escaped key or value into a new string, as
+   `uri.decode_www_form` does.  */
+static mrb_value
+mrb_uriparser_query_decode (mrb_state *const mrb,
+                            const UriTextRangeA *const range)
+{
+  if (!range->first)
+    return mrb_nil_value ();
+  const mrb_value str
+      = mrb_str_new (mrb, range->first, range->afterLast - range->first);
+  const char *const decoded_end = uriUnescapeInPlaceExA (
+      RSTRING_PTR (str), URI_TRUE, URI_BR_DONT_TOUCH);
+  return mrb_str_resize (mrb, str, decoded_end - RSTRING_PTR (str));
+}
+
+/* Append the bytes to the query being rewritten in `out`.  */
+static void
+mrb_uriparser_query_append (char *const out, size_t *const out_len,
+                            const char *const first,
+                            const char *const afterLast)
+{
+  if (*out_len)
+    out[(*out_len)++] = '&';
+  memcpy (out + *out_len, first, afterLast - first);
+  *out_len += afterLast - first;
+}
+
+/* Append the entry encoded as uriComposeQueryA does, which takes
+   `chars_required` characters.  */
+static void
+mrb_uriparser_query_append_entry (mrb_state *const mrb, char *const out,
+                                  size_t *const out_len,
+                                  const UriQueryListA *const entry,
+                                  const int chars_required)
+{
+  if (*out_len)
+    out[(*out_len)++] = '&';
+  int chars_written;
+  if (uriComposeQueryA (out + *out_len, entry, chars_required + 1,
+                        &chars_written)
+      != URI_SUCCESS)
+    MRB_URIPARSER_RAISE (mrb, "failed to compose query");
+  *out_len += chars_written - 1;
+}
+
+/* Replace the query of the URI with the rewritten one, removing the
+   query if no pair is left.  */
+static void
+mrb_uriparser_query_replace (mrb_state *const mrb, UriUriA *const uri,
+                             const char *const out, const size_t out_len)
+{
+  if (uriSetQueryA (uri, out_len ? out : NULL, out_len ? out + out_len : NULL)
+      != URI_SUCCESS)
+    MRB_URIPARSER_RAISE (mrb, "failed to set Query");
+}
+
+/**
+ * @brief Set a query parameter.
+ *
+ * ```ruby
+ * uri.set_query_param(key, value)
+ * ```
+ *
+ * where `uri` is a `URIParser::URI` instance, `key` is `String` and
+ * `value` is `String` or `nil`.  The first pair with the key is
+ * replaced and the others with the key are removed.  If there is no
+ * such pair, it is appended to the query.  Other pairs are kept as they
+ * are, without decoding and encoding them again.
+ *
+ * @return Modified `URIParser::URI` instance.
+ * @sa mrb_uriparser_delete_query_params
+ * @sa mrb_uriparser_filter_query
+ */
+static mrb_value
+mrb_uriparser_set_query_param (mrb_state *const mrb, const mrb_value self)
+{
+  const char *key;
+  const char *value;
+  mrb_get_args (mrb, "zz!", &key, &value);
+  const UriQueryListA entry = { .key = key, .value = value, .next = NULL };
+  int chars_required;
+  if (uriComposeQueryCharsRequiredA (&entry, &chars_required) != URI_SUCCESS)
+    MRB_URIPARSER_RAISE (
+        mrb, "failed to calculate characters required to compose query");
+
+  UriUriA *const uri = MRB_URIPARSER_URI (self);
+  const char *cur = uri->query.first;
+  const char *const end = uri->query.first ? uri->query.afterLast : NULL;
+  const size_t query_len = end - cur;
+  /* Buffers are strings so that raising leaves them to the GC.  */
+  const mrb_value out_str
+      = mrb_str_new (mrb, NULL, query_len + 1 + chars_required + 1);
+  const mrb_value scratch_str = mrb_str_new (mrb, NULL, query_len + 1);
+  char *const out = RSTRING_PTR (out_str);
+  char *const scratch = RSTRING_PTR (scratch_str);
+  const size_t key_len = strlen (key);
+  size_t out_len = 0;
+  mrb_bool found = FALSE;
+  mrb_uriparser_query_pair pair;
+  while (mrb_uriparser_query_next (&cur, end, &pair))
+    {
+      if (!mrb_uriparser_query_key_equals (&pair, scratch, key, key_len))
+        mrb_uriparser_query_append (out, &out_len, pair.pair.first,
+                                    pair.pair.afterLast);
+      else if (!found)
+        {
+          mrb_uriparser_query_append_entry (mrb, out, &out_len, &entry,
+                                            chars_required);
+          found = TRUE;
+        }
+    }
+  if (!found)
+    mrb_uriparser_query_append_entry (mrb, out, &out_len, &entry,
+                                      chars_required);
+  mrb_uriparser_query_replace (mrb, uri, out, out_len);
+  return self;
+}
+
+/**
+ * @brief Delete query parameters.
+ *
+ * ```ruby
+ * uri.delete_query_params(*keys)
+ * ```
+ *
+ * where `uri` is a `URIParser::URI` instance, and each of `keys` is
+ * `String` or a pattern such as `Regexp` matched against keys by `===`.
+ * Other pairs are kept as they are, without decoding and encoding them
+ * again.
+ *
+ * @return Modified `URIParser::URI` instance.
+ * @sa mrb_uriparser_set_query_param
+ */
+static mrb_value
+mrb_uriparser_delete_query_params (mrb_state *const mrb, const mrb_value self)
+{
+  const mrb_value *patterns;
+  mrb_int pattern_count;
+  mrb_get_args (mrb, "*", &patterns, &pattern_count);
+  UriUriA *const uri = MRB_URIPARSER_URI (self);
+  if (!uri->query.first || pattern_count == 0)
+    return self;
+
+  /* Patterns may change the query, so work on a copy of it.  */
+  const mrb_value query_str = mrb_str_new (
+      mrb, uri->query.first, uri->query.afterLast - uri->query.first);
+  const char *cur = RSTRING_PTR (query_str);
+  const char *const end = cur + RSTRING_LEN (query_str);
+  const mrb_value out_str = mrb_str_new (mrb, NULL, end - cur + 1);
+  const mrb_value scratch_str = mrb_str_new (mrb, NULL, end - cur + 1);
+  char *const out = RSTRING_PTR (out_str);
+  char *const scratch = RSTRING_PTR (scratch_str);
+  size_t out_len = 0;
+  const int ai = mrb_gc_arena_save (mrb);
+  mrb_uriparser_query_pair pair;
+  while (mrb_uriparser_query_next (&cur, end, &pair))
+    {
+      mrb_value key = mrb_nil_value ();
+      mrb_bool matched = FALSE;
+      for (mrb_int i = 0; !matched && i < pattern_count; i++)
+        if (mrb_string_p (patterns[i]))
+          matched = mrb_uriparser_query_key_equals (
+              &pair, scratch, RSTRING_PTR (patterns[i]),
+              RSTRING_LEN (patterns[i]));
+        else
+          {
+            if (mrb_nil_p (key))
+              key = mrb_uriparser_query_decode (mrb, &pair.key);
+            matched = mrb_test (
+                mrb_funcall_id (mrb, patterns[i], MRB_OPSYM (eqq), 1, key));
+          }
+      if (!matched)
+        mrb_uriparser_query_append (out, &out_len, pair.pair.first,
+                                    pair.pair.afterLast);
+      mrb_gc_arena_restore (mrb, ai);
+    }
+  mrb_uriparser_query_replace (mrb, MRB_URIPARSER_URI (self), out, out_len);
+  return self;
+}
+
+/**
+ * @brief Keep query parameters for which the block returns true.
+ *
+ * ```ruby
+ * uri.filter_query { |key, value| ... }
+ * ```
+ *
+ * where `uri` is a `URIParser::URI` instance.  The block is given
+ * decoded `key` and `value` as in `uri.decode_www_form`.  Kept pairs
+ * are copied as they are, without encoding them again.
+ *
+ * @return Modified `URIParser::URI` instance.
+ * @sa mrb_uriparser_delete_query_params
+ */
+static mrb_value
+mrb_uriparser_filter_query (mrb_state *const mrb, const mrb_value self)
+{
+  mrb_value block;
+  mrb_get_args (mrb, "&!", &block);
+  UriUriA *const uri = MRB_URIPARSER_URI (self);
+  if (!uri->query.first)
+    return self;
+
+  /* The block may change the query, so work on a copy of it.  */
+  const mrb_value query_str = mrb_str_new (
+      mrb, uri->query.first, uri->query.afterLast - uri->query.first);
+  const char *cur = RSTRING_PTR (query_str);
+  const char *const end = cur + RSTRING_LEN (query_str);
+  const mrb_value out_str = mrb_str_new (mrb, NULL, end - cur + 1);
+  char *const out = RSTRING_PTR (out_str);
+  size_t out_len = 0;
+  const int ai = mrb_gc_arena_save (mrb);
+  mrb_uriparser_query_pair pair;
+  while (mrb_uriparser_query_next (&cur, end, &pair))
+    {
+      const mrb_value args[]
+          = { mrb_uriparser_query_decode (mrb, &pair.key),
+              mrb_uriparser_query_decode (mrb, &pair.value) };
+      if (mrb_test (mrb_yield_argv (mrb, block, 2, args)))
+        mrb_uriparser_query_append (out, &out_len, pair.pair.first,
+                                    pair.pair.afterLast);
+      mrb_gc_arena_restore (mrb, ai);
+    }
+  mrb_uriparser_query_replace (mrb, MRB_URIPARSER_URI (self), out, out_len);
+  return self;
+}
+
+/* Components normalized for cache keys.  The fragment is not part of
+   cache keys.  */
+#define MRB_URIPARSER_CACHE_KEY_NORMALIZE                                     \
+  (URI_NORMALIZE_SCHEME | URI_NORMALIZE_USER_INFO | URI_NORMALIZE_HOST        \
+   | URI_NORMALIZE_PATH | URI_NORMALIZE_QUERY)
+
+/** @brief Default ports dropped from cache keys. */
+static const struct
+{
+  const char *scheme;
+  const char *port;
+} mrb_uriparser_default_ports[] = {
+  { "http", "80" }, { "https", "443" }, { "ws", "80" },
+  { "wss", "443" }, { "ftp", "21" },
+};
+
+static mrb_bool
+mrb_uriparser_range_equals (const UriTextRangeA *const range,
+                            const char *const str)
+{
+  const size_t len = strlen (str);
+  return range->first && (size_t)(range->afterLast - range->first) == len
+         && memcmp (range->first, str, len) == 0;
+}
+
+static mrb_bool
+mrb_uriparser_default_port_p (const UriUriA *const uri)
+{
+  if (!uri->portText.first)
+    return FALSE;
+  if (uri->portText.first == uri->portText.afterLast)
+    return TRUE;
+  for (size_t i = 0; i < sizeof (mrb_uriparser_default_ports)
+                             / sizeof (mrb_uriparser_default_ports[0]);
+       i++)
+    if (mrb_uriparser_range_equals (&uri->scheme,
+                                    mrb_uriparser_default_ports[i].scheme)
+        && mrb_uriparser_range_equals (&uri->portText,
+                                       mrb_uriparser_default_ports[i].port))
+      return TRUE;
+  return FALSE;
+}
+
+static void
+mrb_uriparser_key_append (char *const out, size_t *const out_len,
+                          const char *const first, const char *const afterLast)
+{
+  if (first)
+    {
+      memcpy (out + *out_len, first, afterLast - first);
+      *out_len += afterLast - first;
+    }
+}
+
+/* Whether the bytes of the pair `a` sort after the ones of `b`.  */
+static mrb_bool
+mrb_uriparser_pair_gt (const UriTextRangeA *const a,
+                       const UriTextRangeA *const b)
+{
+  const size_t a_len = a->afterLast - a->first;
+  const size_t b_len = b->afterLast - b->first;
+  const int cmp = memcmp (a->first, b->first, a_len < b_len ? a_len : b_len);
+  return cmp > 0 || (cmp == 0 && a_len > b_len);
+}
+
+/**
+ * Build the cache key of the normalized URI.  `ignore` is an array of
+ * keys of query parameters to drop, already checked to be strings.
+ */
+static mrb_value
+mrb_uriparser_cache_key_of (mrb_state *const mrb, const UriUriA *const uri,
+                            const mrb_value ignore, const mrb_bool sort_query)
+{
+  int chars_required;
+  if (uriToStringCharsRequiredA (uri, &chars_required) != URI_SUCCESS)
+    MRB_URIPARSER_RAISE (mrb, "could not calculate chars required");
+  const char *const query_end = uri->query.first ? uri->query.afterLast : NULL;
+  size_t pair_max = 1;
+  for (const char *p = uri->query.first; p < query_end; p++)
+    pair_max += *p == '&';
+
+  /* Only the pair list is not collected, and nothing raises while it
+     is allocated.  */
+  const mrb_value key_str = mrb_str_new (mrb, NULL, chars_required + 1);
+  const mrb_value scratch_str
+      = mrb_str_new (mrb, NULL, query_end - uri->query.first + 1);
+  char *const out = RSTRING_PTR (key_str);
+  char *const scratch = RSTRING_PTR (scratch_str);
+  UriTextRangeA *const pairs
+      = mrb_malloc (mrb, pair_max * sizeof (UriTextRangeA));
+  size_t out_len = 0;
+
+  if (uri->scheme.first)
+    {
+      mrb_uriparser_key_append (out, &out_len, uri->scheme.first,
+                                uri->scheme.afterLast);
+      out[out_len++] = ':';
+    }
+  const mrb_bool has_host = uriHasHostA (uri);
+  if (has_host)
+    {
+      const mrb_bool bracketed
+          = uri->hostData.ip6 || uri->hostData.ipFuture.first;
+      out[out_len++] = '/';
+      out[out_len++] = '/';
+      if (uri->userInfo.first)
+        {
+          mrb_uriparser_key_append (out, &out_len, uri->userInfo.first,
+                                    uri->userInfo.afterLast);
+          out[out_len++] = '@';
+        }
+      if (bracketed)
+        out[out_len++] = '[';
+      mrb_uriparser_key_append (out, &out_len, uri->hostText.first,
+                                uri->hostText.afterLast);
+      if (bracketed)
+        out[out_len++] = ']';
+      if (uri->portText.first && !mrb_uriparser_default_port_p (uri))
+        {
+          out[out_len++] = ':';
+          mrb_uriparser_key_append (out, &out_len, uri->portText.first,
+                                    uri->portText.afterLast);
+        }
+    }
+  /* An empty path requests the same resource as `/`.  */
+  if (uri->absolutePath || has_host)
+    out[out_len++] = '/';
+  for (const UriPathSegmentA *segment = uri->pathHead; segment;
+       segment = segment->next)
+    {
+      if (segment != uri->pathHead)
+        out[out_len++] = '/';
+      mrb_uriparser_key_append (out, &out_len, segment->text.first,
+                                segment->text.afterLast);
+    }
+
+  size_t pair_count = 0;
+  const char *cur = uri->query.first;
+  mrb_uriparser_query_pair pair;
+  while (mrb_uriparser_query_next (&cur, query_end, &pair))
+    {
+      mrb_bool ignored = FALSE;
+      for (mrb_int i = 0; !ignored && i < RARRAY_LEN (ignore); i++)
+        ignored = mrb_uriparser_query_key_equals (
+            &pair, scratch, RSTRING_PTR (RARRAY_PTR (ignore)[i]),
+            RSTRING_LEN (RARRAY_PTR (ignore)[i]));
+      if (ignored)
+        continue;
+      /* Insertion sort is stable and fast for query-sized inputs.  */
+      size_t i = pair_count++;
+      for (; sort_query && i > 0 && mrb_uriparser_pair_gt (&pairs[i - 1],
+                                                           &pair.pair);
+           i--)
+        pairs[i] = pairs[i - 1];
+      pairs[i] = pair.pair;
+    }
+  for (size_t i = 0; i < pair_count; i++)
+    {
+      out[out_len++] = i ? '&' : '?';
+      mrb_uriparser_key_append (out, &out_len, pairs[i].first,
+                                pairs[i].afterLast);
+    }
+  mrb_free (mrb, pairs);
+  return mrb_str_resize (mrb, key_str, out_len);
+}
+
+/* Get the keyword arguments of cache key methods, checking that
+   `ignore_params` holds strings.  */
+static void
+mrb_uriparser_cache_key_kwargs (mrb_state *const mrb,
+                                mrb_value *const kw_values,
+                                mrb_value *const ignore,
+                                mrb_bool *const sort_query)
+{
+  *ignore = mrb_undef_p (kw_values[0]) ? mrb_ary_new (mrb)
+                                       : mrb_ensure_array_type (mrb,
+                                                                kw_values[0]);
+  for (mrb_int i = 0; i < RARRAY_LEN (*ignore); i++)
+    mrb_ensure_string_type (mrb, RARRAY_PTR (*ignore)[i]);
+  *sort_query = mrb_undef_p (kw_values[1]) || mrb_test (kw_values[1]);
+}
+
+#define MRB_URIPARSER_CACHE_KEY_KWARGS                                        \
+  const mrb_int kw_num = 2;                                                   \
+  const mrb_sym kw_table[]                                                    \
+      = { MRB_SYM (ignore_params), MRB_SYM (sort_query) };                    \
+  mrb_value kw_values[kw_num];                                                \
+  const mrb_kwargs kwargs = { .num = kw_num,                                  \
+                              .required = 0,                                  \
+                              .rest = NULL,                                   \
+                              .table = kw_table,                              \
+                              .values = kw_values };
+
+/**
+ * @brief Generate a cache key of the URI.
+ *
+ * ```ruby
+ * uri.cache_key(ignore_params: [], sort_query: true)
+ * URIParser.cache_key(str, ignore_params: [], sort_query: true)
+ * ```
+ *
+ * where `uri` is a `URIParser::URI` instance and `str` is a URI string.
+ * `ignore_params` is an array of keys of query parameters to drop.  If
+ * `sort_query` is true, query parameters are sorted.
+ *
+ * The key is the URI normalized as by `uri.normalize!`, without the
+ * fragment and the default port of the scheme, and with `/` for an
+ * empty path.  The URI itself is not modified.
+ *
+ * @return Cache key string.
+ * @sa mrb_uriparser_normalize
+ */
+static mrb_value
+mrb_uriparser_cache_key (mrb_state *const mrb, const mrb_value self)
+{
+  MRB_URIPARSER_CACHE_KEY_KWARGS;
+  mrb_get_args (mrb, ":", &kwargs);
+  mrb_value ignore;
+  mrb_bool sort_query;
+  mrb_uriparser_cache_key_kwargs (mrb, kw_values, &ignore, &sort_query);
+
+  const UriUriA *const uri = MRB_URIPARSER_URI (self);
+  const unsigned int mask = uriNormalizeSyntaxMaskRequiredA (uri)
+                            & MRB_URIPARSER_CACHE_KEY_NORMALIZE;
+  if (mask == URI_NORMALIZED)
+    return mrb_uriparser_cache_key_of (mrb, uri, ignore, sort_query);
+
+  UriUriA *const normalized = mrb_malloc (mrb, sizeof (UriUriA));
+  if (uriCopyUriA (normalized, uri) != URI_SUCCESS)
+    {
+      mrb_free (mrb, normalized);
+      MRB_URIPARSER_RAISE (mrb, "failed to copy URI");
+    }
+  /* The arena keeps the wrapping object, which frees the copy, alive.  */
+  mrb_uriparser_wrap (mrb, normalized, NULL);
+  if (uriNormalizeSyntaxExA (normalized, mask) != URI_SUCCESS)
+    MRB_URIPARSER_RAISE (mrb, "failed to normalize");
+  return mrb_uriparser_cache_key_of (mrb, normalized, ignore, sort_query);
+}
+
+/* @sa mrb_uriparser_cache_key */
+static mrb_value
+mrb_uriparser_cache_key_str (mrb_state *const mrb, const mrb_value self)
+{
+  const char *str = NULL;
+  MRB_URIPARSER_CACHE_KEY_KWARGS;
+  mrb_get_args (mrb, "z:", &str, &kwargs);
+  mrb_value ignore;
+  mrb_bool sort_query;
+  mrb_uriparser_cache_key_kwargs (mrb, kw_values, &ignore, &sort_query);
+
+  const mrb_value parsed = mrb_uriparser_parse_cstr (mrb, str);
+  UriUriA *const uri = MRB_URIPARSER_URI (parsed);
+  if (uriNormalizeSyntaxExA (uri, MRB_URIPARSER_CACHE_KEY_NORMALIZE)
+      != URI_SUCCESS)
+    MRB_URIPARSER_RAISE (mrb, "failed to normalize");
+  return mrb_uriparser_cache_key_of (mrb, uri, ignore, sort_query);
+}
+
+/** @brief Item of a batch. */
+typedef struct
+{
+  /** Source string. */
+  const char *first;
+  /** End of the source string. */
+  const char *afterLast;
+  /** Copy of the source which `uri` points into, for parsing. */
+  char *text;
+  /** Parsed URI, for parsing. */
+  UriUriA *uri;
+  /** Result of the work on the item. */
+  int status;
+  /** Parse error position, if parsing failed. */
+  const char *error_pos;
+  /** Offset of the normalized string in the arena of its worker. */
+  size_t offset;
+  /** Length of the normalized string. */
+  size_t len;
+} mrb_uriparser_batch_item;
+
+/**
+ * @brief Worker of a batch, which works on the items from `first` to
+ * `afterLast`.
+ *
+ * Workers do not touch the mruby state.  Normalized strings are
+ * written to the arena of the worker, which is allocated with the
+ * standard allocator.
+ */
+typedef struct
+{
+  mrb_uriparser_batch_item *items;
+  size_t first;
+  size_t afterLast;
+  mrb_bool normalize;
+  char *arena;
+  size_t arena_len;
+  size_t arena_capa;
+} mrb_uriparser_batch_worker;
+
+/** @brief State of a batch owned by a data object while running. */
+typedef struct
+{
+  mrb_uriparser_batch_item *items;
+  size_t count;
+  mrb_uriparser_batch_worker *workers;
+  size_t worker_count;
+} mrb_uriparser_batch;
+
+static void
+mrb_uriparser_batch_free (mrb_state *const mrb, void *const p)
+{
+  mrb_uriparser_batch *const batch = p;
+  if (!batch)
+    return;
+  for (size_t i = 0; batch->items && i < batch->count; i++)
+    {
+      mrb_uriparser_batch_item *const item = &batch->items[i];
+      if (item->uri && item->status == URI_SUCCESS)
+        uriFreeUriMembersA (item->uri);
+      mrb_free (mrb, item->uri);
+      mrb_free (mrb, item->text);
+    }
+  for (size_t i = 0; batch->workers && i < batch->worker_count; i++)
+    free (batch->workers[i].arena);
+  mrb_free (mrb, batch->workers);
+  mrb_free (mrb, batch->items);
+  mrb_free (mrb, batch);
+}
+
+static const struct mrb_data_type mrb_uriparser_batch_type = {
+  .struct_name = "mrb_uriparser_batch",
+  .dfree = mrb_uriparser_batch_free,
+};
+
+/* Normalize the item into the arena of the worker.  */
+static int
+mrb_uriparser_batch_normalize (mrb_uriparser_batch_worker *const worker,
+                               mrb_uriparser_batch_item *const item)
+{
+  UriUriA uri;
+  int status = uriParseSingleUriExA (&uri, item->first, item->afterLast,
+                                     &item->error_pos);
+  if (status != URI_SUCCESS)
+    return status;
+  int chars_required;
+  if ((status = uriNormalizeSyntaxExA (&uri, MRB_URIPARSER_NORMALIZE_ALL))
+          == URI_SUCCESS
+      && (status = uriToStringCharsRequiredA (&uri, &chars_required))
+             == URI_SUCCESS)
+    {
+      const size_t needed = worker->arena_len + chars_required + 1;
+      if (needed > worker->arena_capa)
+        {
+          const size_t capa = needed > 2 * worker->arena_capa
+                                  ? needed
+                                  : 2 * worker->arena_capa;
+          char *const arena = realloc (worker->arena, capa);
+          if (arena)
+            {
+              worker->arena = arena;
+              worker->arena_capa = capa;
+            }
+          else
+            status = URI_ERROR_MALLOC;
+        }
+      if (status == URI_SUCCESS)
+        status = uriToStringA (worker->arena + worker->arena_len, &uri,
+                               chars_required + 1, NULL);
+      if (status == URI_SUCCESS)
+        {
+          item->offset = worker->arena_len;
+          item->len = chars_required;
+          worker->arena_len += chars_required;
+        }
+    }
+  uriFreeUriMembersA (&uri);
+  return status;
+}
+
+static void *
+mrb_uriparser_batch_work (void *const p)
+{
+  mrb_uriparser_batch_worker *const worker = p;
+  for (size_t i = worker->first; i < worker->afterLast; i++)
+    {
+      mrb_uriparser_batch_item *const item = &worker->items[i];
+      item->status = worker->normalize
+                         ? mrb_uriparser_batch_normalize (worker, item)
+                         : uriParseSingleUriExA (item->uri, item->text,
+                                                 item->text + item->len,
+                                                 &item->error_pos);
+    }
+  return NULL;
+}
+
+/* Run the workers, each on its own thread but the first, which runs on
+   the calling one.  */
+static void
+mrb_uriparser_batch_run (mrb_uriparser_batch *const batch)
+{
+#ifndef MRB_URIPARSER_NO_THREADS
+  pthread_t threads[MRB_URIPARSER_MAX_THREADS];
+  mrb_bool started[MRB_URIPARSER_MAX_THREADS] = { FALSE };
+  for (size_t i = 1; i < batch->worker_count; i++)
+    started[i] = pthread_create (&threads[i], NULL, mrb_uriparser_batch_work,
+                                 &batch->workers[i])
+                 == 0;
+  mrb_uriparser_batch_work (&batch->workers[0]);
+  for (size_t i = 1; i < batch->worker_count; i++)
+    if (started[i])
+      pthread_join (threads[i], NULL);
+    else
+      mrb_uriparser_batch_work (&batch->workers[i]);
+#else
+  for (size_t i = 0; i < batch->worker_count; i++)
+    mrb_uriparser_batch_work (&batch->workers[i]);
+#endif
+}
+
+/**
+ * Set up and run a batch over the array of strings.  The returned data
+ * object owns the batch, so raising frees it.
+ */
+static mrb_value
+mrb_uriparser_batch_new (mrb_state *const mrb, const mrb_value ary,
+                         const mrb_value threads, const mrb_bool normalize)
+{
+  const mrb_value holder = mrb_obj_value (mrb_data_object_alloc (
+      mrb, mrb->object_class, NULL, &mrb_uriparser_batch_type));
+  mrb_uriparser_batch *const batch
+      = mrb_calloc (mrb, 1, sizeof (mrb_uriparser_batch));
+  DATA_PTR (holder) = batch;
+
+  const size_t count = RARRAY_LEN (ary);
+  mrb_int thread_count = mrb_undef_p (threads) ? 1 : mrb_as_int (mrb, threads);
+  if (thread_count < 1)
+    mrb_raise (mrb, E_ARGUMENT_ERROR, "threads must be positive");
+  if (thread_count > MRB_URIPARSER_MAX_THREADS)
+    thread_count = MRB_URIPARSER_MAX_THREADS;
+  const size_t thread_max = count / MRB_URIPARSER_MIN_BATCH_PER_THREAD;
+  if ((size_t)thread_count > thread_max)
+    thread_count = thread_max ? thread_max : 1;
+
+  batch->items = mrb_calloc (mrb, count ? count : 1,
+                             sizeof (mrb_uriparser_batch_item));
+  batch->count = count;
+  for (size_t i = 0; i < count; i++)
+    {
+      mrb_uriparser_batch_item *const item = &batch->items[i];
+      const mrb_value str = mrb_ensure_string_type (mrb, RARRAY_PTR (ary)[i]);
+      item->first = RSTRING_PTR (str);
+      item->afterLast = item->first + RSTRING_LEN (str);
+      if (normalize)
+        continue;
+      item->len = RSTRING_LEN (str);
+      item->text = mrb_malloc (mrb, item->len + 1);
+      memcpy (item->text, item->first, item->len);
+      item->text[item->len] = '\0';
+      item->uri = mrb_malloc (mrb, sizeof (UriUriA));
+      item->status = URI_ERROR_NULL; /* not parsed yet */
+    }
+
+  batch->workers = mrb_calloc (mrb, thread_count,
+                               sizeof (mrb_uriparser_batch_worker));
+  batch->worker_count = thread_count;
+  for (mrb_int i = 0; i < thread_count; i++)
+    batch->workers[i] = (mrb_uriparser_batch_worker){
+      .items = batch->items,
+      .first = count * i / thread_count,
+      .afterLast = count * (i + 1) / thread_count,
+      .normalize = normalize,
+    };
+  mrb_uriparser_batch_run (batch);
+
+  for (size_t i = 0; i < count; i++)
+    {
+      const mrb_uriparser_batch_item *const item = &batch->items[i];
+      if (item->status == URI_SUCCESS)
+        continue;
+      if (item->status != URI_ERROR_SYNTAX)
+        MRB_URIPARSER_RAISE (mrb, normalize ? "failed to normalize"
+                                            : "failed to parse");
+      mrb_value msg = mrb_format (mrb, "%s: `%s'", MRB_URIPARSER_PARSE_FAILED,
+                                  item->error_pos);
+      MRB_URIPARSER_RAISE (mrb, RSTRING_PTR (msg));
+    }
+  return holder;
+}
+
+#define MRB_URIPARSER_BATCH_KWARGS                                            \
+  const mrb_sym threads_key = MRB_SYM (threads);                              \
+  mrb_value threads;                                                          \
+  const mrb_kwargs kwargs = { .num = 1,                                       \
+                              .required = 0,                                  \
+                              .rest = NULL,                                   \
+                              .table = &threads_key,                          \
+                              .values = &threads };
+
+/**
+ * @brief Parse strings into URI objects.
+ *
+ * ```ruby
+ * URIParser.parse_many(strs, threads: 1)
+ * ```
+ *
+ * where `strs` is `Array` of URI strings.  Strings are parsed by up to
+ * `threads` threads, while objects are made on the calling thread.
+ * Each thread gets at least `MRB_URIPARSER_MIN_BATCH_PER_THREAD`
+ * strings, so small batches run on the calling thread only.
+ *
+ * @return Array of `URIParser::URI` instances.
+ * @sa mrb_uriparser_parse
+ */
+static mrb_value
+mrb_uriparser_parse_many (mrb_state *const mrb, const mrb_value self)
+{
+  mrb_value ary;
+  MRB_URIPARSER_BATCH_KWARGS;
+  mrb_get_args (mrb, "A:", &ary, &kwargs);
+  const mrb_value holder = mrb_uriparser_batch_new (mrb, ary, threads, FALSE);
+  mrb_uriparser_batch *const batch = DATA_PTR (holder);
+  const mrb_value uris = mrb_ary_new_capa (mrb, batch->count);
+  const int ai = mrb_gc_arena_save (mrb);
+  for (size_t i = 0; i < batch->count; i++)
+    {
+      /* Hand the URI over before wrapping it, as wrapping releases it
+         when raising.  */
+      mrb_uriparser_batch_item *const item = &batch->items[i];
+      UriUriA *const uri = item->uri;
+      char *const text = item->text;
+      item->uri = NULL;
+      item->text = NULL;
+      mrb_ary_push (mrb, uris, mrb_uriparser_wrap (mrb, uri, text));
+      mrb_gc_arena_restore (mrb, ai);
+    }
+  mrb_uriparser_batch_free (mrb, batch);
+  DATA_PTR (holder) = NULL;
+  return uris;
+}
+
+/**
+ * @brief Normalize URI strings.
+ *
+ * ```ruby
+ * URIParser.normalize_many(strs, threads: 1)
+ * ```
+ *
+ * where `strs` is `Array` of URI strings.  Strings are parsed,
+ * normalized as by `uri.normalize!` and serialized by up to `threads`
+ * threads, with the same lower limit of strings for each thread as
+ * `URIParser.parse_many`.
+ *
+ * @return Array of normalized URI strings.
+ * @sa mrb_uriparser_normalize
+ */
+static mrb_value
+mrb_uriparser_normalize_many (mrb_state *const mrb, const mrb_value self)
+{
+  mrb_value ary;
+  MRB_URIPARSER_BATCH_KWARGS;
+  mrb_get_args (mrb, "A:", &ary, &kwargs);
+  const mrb_value holder = mrb_uriparser_batch_new (mrb, ary, threads, TRUE);
+  mrb_uriparser_batch *const batch = DATA_PTR (holder);
+  const mrb_value strs = mrb_ary_new_capa (mrb, batch->count);
+  const int ai = mrb_gc_arena_save (mrb);
+  for (size_t w = 0; w < batch->worker_count; w++)
+    {
+      const mrb_uriparser_batch_worker *const worker = &batch->workers[w];
+      for (size_t i = worker->first; i < worker->afterLast; i++)
+        {
+          const mrb_uriparser_batch_item *const item = &batch->items[i];
+          mrb_ary_push (mrb, strs,
+                        mrb_str_new (mrb, worker->arena + item->offset,
+                                     item->len));
+          mrb_gc_arena_restore (mrb, ai);
+        }
+    }
+  mrb_uriparser_batch_free (mrb, batch);
+  DATA_PTR (holder) = NULL;
+  return strs;
+}
+
+/* Binary dump format, version 1.  Integers are unsigned 32-bit
+   little-endian and ranges are pairs of text offset and length, where
+   the offset MRB_URIPARSER_DUMP_ABSENT stands for a missing component.
+
+     magic "URIP", version, flags, text length, segment count,
+     scheme, userinfo, host, port, IPv4 (4) or IPv6 (16) address,
+     path segments, query, fragment, text
+
+   The text is the URI string itself, so that loading only has to point
+   the ranges into it.  `URIParser.dump_all` prefixes the records with
+   the magic "URIA", the version and the record count.  */
+
+#define MRB_URIPARSER_DUMP_MAGIC "URIP"
+#define MRB_URIPARSER_DUMP_ALL_MAGIC "URIA"
+#define MRB_URIPARSER_DUMP_VERSION 1
+#define MRB_URIPARSER_DUMP_ABSENT UINT32_MAX
+#define MRB_URIPARSER_DUMP_HEADER_SIZE (4 + 1 + 1 + 4 + 4)
+#define MRB_URIPARSER_DUMP_ALL_HEADER_SIZE (4 + 1 + 4)
+#define MRB_URIPARSER_DUMP_RANGE_SIZE 8
+
+#define MRB_URIPARSER_DUMP_ABSOLUTE_PATH 0x01
+#define MRB_URIPARSER_DUMP_IP4 0x02
+#define MRB_URIPARSER_DUMP_IP6 0x04
+#define MRB_URIPARSER_DUMP_IP_FUTURE 0x08
+
+#define MRB_URIPARSER_INVALID_DUMP "invalid URI dump"
+
+/**
+ * @brief State of writing one dump record.
+ *
+ * With `header` and `text` set to `NULL` nothing is written and only
+ * `text_len` and `segment_count` are accumulated, so the same walk
+ * measures the record before writing it.
+ */
+typedef struct
+{
+  /** Next range slot in the header. */
+  unsigned char *header;
+  /** Start of the text area. */
+  char *text;
+  /** Length of the text written so far. */
+  size_t text_len;
+  /** Number of path segments written so far. */
+  uint32_t segment_count;
+} mrb_uriparser_dump_writer;
+
+/**
+ * @brief Measurements of one dump record, taken before writing it.
+ */
+typedef struct
+{
+  /** Size of the whole record. */
+  size_t size;
+  /** Length of the text area. */
+  uint32_t text_len;
+  /** Number of path segments. */
+  uint32_t segment_count;
+} mrb_uriparser_dump_measure;
+
+static unsigned char *
+mrb_uriparser_put_u32 (unsigned char *const p, const uint32_t n)
+{
+  p[0] = n & 0xff;
+  p[1] = (n >> 8) & 0xff;
+  p[2] = (n >> 16) & 0xff;
+  p[3] = (n >> 24) & 0xff;
+  return p + 4;
+}
+
+static uint32_t
+mrb_uriparser_get_u32 (const unsigned char *const p)
+{
+  return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16
+         | (uint32_t)p[3] << 24;
+}
+
+static void
+mrb_uriparser_dump_text (mrb_uriparser_dump_writer *const w,
+                         const char *const text, const size_t len)
+{
+  if (w->text)
+    memcpy (w->text + w->text_len, text, len);
+  w->text_len += len;
+}
+
+static void
+mrb_uriparser_dump_range (mrb_uriparser_dump_writer *const w,
+                          const UriTextRangeA *const range)
+{
+  const mrb_bool absent = !range->first || !range->afterLast;
+  const size_t len = absent ? 0 : range->afterLast - range->first;
+  if (w->header)
+    {
+      w->header = mrb_uriparser_put_u32 (
+          w->header, absent ? MRB_URIPARSER_DUMP_ABSENT : w->text_len);
+      w->header = mrb_uriparser_put_u32 (w->header, len);
+    }
+  if (!absent)
+    mrb_uriparser_dump_text (w, range->first, len);
+}
+
+/* Walk the components in the order of the format, mirroring
+   uriToStringA for the delimiters in the text.  */
+static void
+mrb_uriparser_dump_walk (mrb_uriparser_dump_writer *const w,
+                         const UriUriA *const uri)
+{
+  const mrb_bool has_host = uriHasHostA (uri);
+  const mrb_bool bracketed = uri->hostData.ip6 || uri->hostData.ipFuture.first;
+
+  mrb_uriparser_dump_range (w, &uri->scheme);
+  if (uri->scheme.first)
+    mrb_uriparser_dump_text (w, ":", 1);
+  if (has_host)
+    mrb_uriparser_dump_text (w, "//", 2);
+  mrb_uriparser_dump_range (w, &uri->userInfo);
+  if (uri->userInfo.first)
+    mrb_uriparser_dump_text (w, "@", 1);
+  if (bracketed)
+    mrb_uriparser_dump_text (w, "[", 1);
+  mrb_uriparser_dump_range (w, &uri->hostText);
+  if (bracketed)
+    mrb_uriparser_dump_text (w, "]", 1);
+  if (uri->portText.first)
+    mrb_uriparser_dump_text (w, ":", 1);
+  mrb_uriparser_dump_range (w, &uri->portText);
+
+  if (w->header && uri->hostData.ip4)
+    {
+      memcpy (w->header, uri->hostData.ip4->data, 4);
+      w->header += 4;
+    }
+  else if (w->header && uri->hostData.ip6)
+    {
+      memcpy (w->header, uri->hostData.ip6->data, 16);
+      w->header += 16;
+    }
+
+  if (uri->absolutePath || (uri->pathHead && has_host))
+    mrb_uriparser_dump_text (w, "/", 1);
+  for (const UriPathSegmentA *segment = uri->pathHead; segment;
+       segment = segment->next)
+    {
+      if (segment != uri->pathHead)
+        mrb_uriparser_dump_text (w, "/", 1);
+      mrb_uriparser_dump_range (w, &segment->text);
+      w->segment_count++;
+    }
+
+  if (uri->query.first)
+    mrb_uriparser_dump_text (w, "?", 1);
+  mrb_uriparser_dump_range (w, &uri->query);
+  if (uri->fragment.first)
+    mrb_uriparser_dump_text (w, "#", 1);
+  mrb_uriparser_dump_range (w, &uri->fragment);
+}
+
+/* Measure the dump record of the URI.  */
+static mrb_uriparser_dump_measure
+mrb_uriparser_dump_size (mrb_state *const mrb, const UriUriA *const uri)
+{
+  mrb_uriparser_dump_writer w = { 0 };
+  mrb_uriparser_dump_walk (&w, uri);
+  if (w.text_len >= MRB_URIPARSER_DUMP_ABSENT)
+    MRB_URIPARSER_RAISE (mrb, "URI is too long to dump");
+  return (mrb_uriparser_dump_measure){
+    .size = MRB_URIPARSER_DUMP_HEADER_SIZE
+            + (6 + w.segment_count) * MRB_URIPARSER_DUMP_RANGE_SIZE
+            + (uri->hostData.ip4 ? 4 : uri->hostData.ip6 ? 16 : 0)
+            + w.text_len,
+    .text_len = w.text_len,
+    .segment_count = w.segment_count,
+  };
+}
+
+/* Write the dump record of the URI, as measured by
+   mrb_uriparser_dump_size, to `p`.  */
+static void
+mrb_uriparser_dump_write (unsigned char *const p,
+                          const mrb_uriparser_dump_measure *const measure,
+                          const UriUriA *const uri)
+{
+  memcpy (p, MRB_URIPARSER_DUMP_MAGIC, 4);
+  p[4] = MRB_URIPARSER_DUMP_VERSION;
+  p[5] = (uri->absolutePath ? MRB_URIPARSER_DUMP_ABSOLUTE_PATH : 0)
+         | (uri->hostData.ip4 ? MRB_URIPARSER_DUMP_IP4 : 0)
+         | (uri->hostData.ip6 ? MRB_URIPARSER_DUMP_IP6 : 0)
+         | (uri->hostData.ipFuture.first ? MRB_URIPARSER_DUMP_IP_FUTURE : 0);
+  mrb_uriparser_put_u32 (p + 6, measure->text_len);
+  mrb_uriparser_put_u32 (p + 10, measure->segment_count);
+
+  mrb_uriparser_dump_writer w = {
+    .header = p + MRB_URIPARSER_DUMP_HEADER_SIZE,
+    .text = (char *)p + measure->size - measure->text_len,
+  };
+  mrb_uriparser_dump_walk (&w, uri);
+}
+
+/**
+ * @brief Reader of dump records.
+ */
+typedef struct
+{
+  /** Next byte to read. */
+  const unsigned char *p;
+  /** End of the bytes. */
+  const unsigned char *end;
+} mrb_uriparser_dump_reader;
+
+/* Read a range into `range`, pointing it into `text`.  */
+static mrb_bool
+mrb_uriparser_load_range (mrb_uriparser_dump_reader *const r,
+                          const char *const text, const uint32_t text_len,
+                          UriTextRangeA *const range)
+{
+  if (r->end - r->p < MRB_URIPARSER_DUMP_RANGE_SIZE)
+    return FALSE;
+  const uint32_t offset = mrb_uriparser_get_u32 (r->p);
+  const uint32_t len = mrb_uriparser_get_u32 (r->p + 4);
+  r->p += MRB_URIPARSER_DUMP_RANGE_SIZE;
+  if (offset == MRB_URIPARSER_DUMP_ABSENT)
+    {
+      range->first = range->afterLast = NULL;
+      return len == 0;
+    }
+  if (offset > text_len || len > text_len - offset)
+    return FALSE;
+  range->first = text + offset;
+  range->afterLast = range->first + len;
+  return TRUE;
+}
+
+/**
+ * Read one dump record from the reader and build a `URIParser::URI`
+ * instance of it.  The ranges are pointed into a copy of the text in
+ * the record, so the grammar is not scanned again.
+ */
+static mrb_value
+mrb_uriparser_load_record (mrb_state *const mrb,
+                           mrb_uriparser_dump_reader *const r)
+{
+  if (r->end - r->p < MRB_URIPARSER_DUMP_HEADER_SIZE
+      || memcmp (r->p, MRB_URIPARSER_DUMP_MAGIC, 4) != 0)
+    MRB_URIPARSER_RAISE (mrb, MRB_URIPARSER_INVALID_DUMP);
+  if (r->p[4] != MRB_URIPARSER_DUMP_VERSION)
+    MRB_URIPARSER_RAISE (mrb, "unsupported URI dump version");
+  const unsigned char flags = r->p[5];
+  const uint32_t text_len = mrb_uriparser_get_u32 (r->p + 6);
+  const uint32_t segment_count = mrb_uriparser_get_u32 (r->p + 10);
+  const size_t ip_len = (flags & MRB_URIPARSER_DUMP_IP4)   ? 4
+                        : (flags & MRB_URIPARSER_DUMP_IP6) ? 16
+                                                           : 0;
+  if ((size_t)(r->end - r->p)
+      < MRB_URIPARSER_DUMP_HEADER_SIZE + ip_len + (size_t)text_len
+            + (6 + (size_t)segment_count) * MRB_URIPARSER_DUMP_RANGE_SIZE)
+    MRB_URIPARSER_RAISE (mrb, MRB_URIPARSER_INVALID_DUMP);
+  const unsigned char *const text_src
+      = r->p + MRB_URIPARSER_DUMP_HEADER_SIZE + ip_len
+        + (6 + (size_t)segment_count) * MRB_URIPARSER_DUMP_RANGE_SIZE;
+  r->p += MRB_URIPARSER_DUMP_HEADER_SIZE;
+
+  char *const text = mrb_malloc (mrb, text_len + 1);
+  memcpy (text, text_src, text_len);
+  text[text_len] = '\0';
+  UriUriA *const uri = mrb_malloc_simple (mrb, sizeof (UriUriA));
+  if (!uri)
+    {
+      mrb_free (mrb, text);
+      MRB_URIPARSER_RAISE_NOMEM (mrb, "failed to allocate URI");
+    }
+  memset (uri, 0, sizeof (UriUriA));
+  uri->absolutePath = (flags & MRB_URIPARSER_DUMP_ABSOLUTE_PATH) ? URI_TRUE
+                                                                 : URI_FALSE;
+  uri->owner = URI_FALSE;
+
+  mrb_bool ok
+      = mrb_uriparser_load_range (r, text, text_len, &uri->scheme)
+        && mrb_uriparser_load_range (r, text, text_len, &uri->userInfo)
+        && mrb_uriparser_load_range (r, text, text_len, &uri->hostText)
+        && mrb_uriparser_load_range (r, text, text_len, &uri->portText);
+  if (ok && (flags & MRB_URIPARSER_DUMP_IP_FUTURE))
+    uri->hostData.ipFuture = uri->hostText;
+
+  /* uriFreeUriMembersA releases the host data and path segments with
+     the default memory manager of uriparser, so allocate them with the
+     standard allocator.  */
+  if (ok && ip_len == 4)
+    {
+      uri->hostData.ip4 = malloc (sizeof (UriIp4));
+      if ((ok = uri->hostData.ip4 != NULL))
+        memcpy (uri->hostData.ip4->data, r->p, 4);
+    }
+  else if (ok && ip_len == 16)
+    {
+      uri->hostData.ip6 = malloc (sizeof (UriIp6));
+      if ((ok = uri->hostData.ip6 != NULL))
+        memcpy (uri->hostData.ip6->data, r->p, 16);
+    }
+  r->p += ip_len;
+
+  for (uint32_t i = 0; ok && i < segment_count; i++)
+    {
+      UriPathSegmentA *const segment = malloc (sizeof (UriPathSegmentA));
+      if (!segment)
+        {
+          ok = FALSE;
+          break;
+        }
+      segment->next = NULL;
+      segment->reserved = NULL;
+      if (uri->pathTail)
+        uri->pathTail->next = segment;
+      else
+        uri->pathHead = segment;
+      uri->pathTail = segment;
+      ok = mrb_uriparser_load_range (r, text, text_len, &segment->text);
+    }
+
+  ok = ok && mrb_uriparser_load_range (r, text, text_len, &uri->query)
+       && mrb_uriparser_load_range (r, text, text_len, &uri->fragment);
+  if (!ok)
+    {
+      mrb_uriparser_release (mrb, uri, text);
+      MRB_URIPARSER_RAISE (mrb, MRB_URIPARSER_INVALID_DUMP);
+    }
+  r->p += text_len;
+  MRB_URIPARSER_NEW_WITH_TEXT (mrb, uri, text);
+}
+
+/**
+ * @brief Dump the URI into a binary string.
+ *
+ * ```ruby
+ * uri.dump
+ * ```
+ *
+ * where `uri` is a `URIParser::URI` instance.  The string keeps the
+ * URI text together with the offsets of its components and path
+ * segments, so that loading it does not parse the URI again.
+ *
+ * @return Binary string.
+ * @sa mrb_uriparser_load
+ * @sa mrb_uriparser_dump_all
+ */
+static mrb_value
+mrb_uriparser_dump (mrb_state *const mrb, const mrb_value self)
+{
+  const UriUriA *const uri = MRB_URIPARSER_URI (self);
+  const mrb_uriparser_dump_measure measure
+      = mrb_uriparser_dump_size (mrb, uri);
+  const mrb_value str = mrb_str_new (mrb, NULL, measure.size);
+  mrb_uriparser_dump_write ((unsigned char *)RSTRING_PTR (str), &measure,
+                            uri);
+  return str;
+}
+
+/**
+ * @brief Load a URI from a binary string.
+ *
+ * ```ruby
+ * URIParser.load(bytes)
+ * URIParser::URI.load(bytes)
+ * ```
+ *
+ * where `bytes` is a string made by `uri.dump`.
+ *
+ * @return `URIParser::URI` instance.
+ * @sa mrb_uriparser_dump
+ */
+static mrb_value
+mrb_uriparser_load (mrb_state *const mrb, const mrb_value self)
+{
+  const char *bytes;
+  mrb_int bytes_len;
+  mrb_get_args (mrb, "s", &bytes, &bytes_len);
+  mrb_uriparser_dump_reader r = { .p = (const unsigned char *)bytes,
+                                  .end = (const unsigned char *)bytes
+                                         + bytes_len };
+  const mrb_value uri = mrb_uriparser_load_record (mrb, &r);
+  if (r.p != r.end)
+    MRB_URIPARSER_RAISE (mrb, MRB_URIPARSER_INVALID_DUMP);
+  return uri;
+}
+
+/**
+ * @brief Dump URIs into a binary string.
+ *
+ * ```ruby
+ * URIParser.dump_all(uris)
+ * ```
+ *
+ * where `uris` is `Array` of `URIParser::URI`.
+ *
+ * @return Binary string.
+ * @sa mrb_uriparser_load_all
+ */
+static mrb_value
+mrb_uriparser_dump_all (mrb_state *const mrb, const mrb_value self)
+{
+  mrb_value ary;
+  mrb_get_args (mrb, "A", &ary);
+  const mrb_int len = RARRAY_LEN (ary);
+  if (len >= MRB_URIPARSER_DUMP_ABSENT)
+    MRB_URIPARSER_RAISE (mrb, "too many URIs to dump");
+  struct RClass *const uri_class = MRB_URIPARSER_URI_CLASS (mrb);
+  /* Keep the measurements, so that each URI is walked once to measure
+     and once to write.  */
+  const mrb_value measures
+      = mrb_str_new (mrb, NULL, len * sizeof (mrb_uriparser_dump_measure));
+  mrb_uriparser_dump_measure *const measure
+      = (mrb_uriparser_dump_measure *)RSTRING_PTR (measures);
+  size_t size = MRB_URIPARSER_DUMP_ALL_HEADER_SIZE;
+  for (mrb_int i = 0; i < len; i++)
+    {
+      const mrb_value uri = RARRAY_PTR (ary)[i];
+      if (!mrb_obj_is_kind_of (mrb, uri, uri_class))
+        MRB_URIPARSER_RAISE (mrb, "URI is expected to be URIParser::URI");
+      measure[i] = mrb_uriparser_dump_size (mrb, MRB_URIPARSER_URI (uri));
+      size += measure[i].size;
+    }
+
+  const mrb_value str = mrb_str_new (mrb, NULL, size);
+  unsigned char *p = (unsigned char *)RSTRING_PTR (str);
+  memcpy (p, MRB_URIPARSER_DUMP_ALL_MAGIC, 4);
+  p[4] = MRB_URIPARSER_DUMP_VERSION;
+  p = mrb_uriparser_put_u32 (p + 5, len);
+  for (mrb_int i = 0; i < len; i++)
+    {
+      const UriUriA *const uri = MRB_URIPARSER_URI (RARRAY_PTR (ary)[i]);
+      mrb_uriparser_dump_write (p, &measure[i], uri);
+      p += measure[i].size;
+    }
+  return str;
+}
+
+/**
+ * @brief Load URIs from a binary string.
+ *
+ * ```ruby
+ * URIParser.load_all(bytes)
+ * ```
+ *
+ * where `bytes` is a string made by `URIParser.dump_all`.
+ *
+ * @return Array of `URIParser::URI`.
+ * @sa mrb_uriparser_dump_all
+ */
+static mrb_value
+mrb_uriparser_load_all (mrb_state *const mrb, const mrb_value self)
+{
+  const char *bytes;
+  mrb_int bytes_len;
+  mrb_get_args (mrb, "s", &bytes, &bytes_len);
+  mrb_uriparser_dump_reader r = { .p = (const unsigned char *)bytes,
+                                  .end = (const unsigned char *)bytes
+                                         + bytes_len };
+  if (bytes_len < MRB_URIPARSER_DUMP_ALL_HEADER_SIZE
+      || memcmp (r.p, MRB_URIPARSER_DUMP_ALL_MAGIC, 4) != 0)
+    MRB_URIPARSER_RAISE (mrb, MRB_URIPARSER_INVALID_DUMP);
+  if (r.p[4] != MRB_URIPARSER_DUMP_VERSION)
+    MRB_URIPARSER_RAISE (mrb, "unsupported URI dump version");
+  const uint32_t count = mrb_uriparser_get_u32 (r.p + 5);
+  r.p += MRB_URIPARSER_DUMP_ALL_HEADER_SIZE;
+  /* Each record takes at least the header, so do not trust the count
+     further than the bytes go.  */
+  const mrb_value ary = mrb_ary_new_capa (
+      mrb, count < bytes_len / MRB_URIPARSER_DUMP_HEADER_SIZE
+               ? count
+               : bytes_len / MRB_URIPARSER_DUMP_HEADER_SIZE);
+  const int ai = mrb_gc_arena_save (mrb);
+  for (uint32_t i = 0; i < count; i++)
+    {
+      mrb_ary_push (mrb, ary, mrb_uriparser_load_record (mrb, &r));
+      mrb_gc_arena_restore (mrb, ai);
+    }
+  if (r.p != r.end)
+    MRB_URIPARSER_RAISE (mrb, MRB_URIPARSER_INVALID_DUMP);
+  return ary;
+}
+
+void
+mrb_mruby_uriparser_gem_init (mrb_state *const mrb)
+{
+  /* C have to define classes here before Ruby does. */
+  struct RClass *const uriparser
+      = mrb_define_module_id (mrb, MRB_SYM (URIParser));
+  mrb_define_module_function_id (mrb, uriparser, MRB_SYM (parse),
+                                 mrb_uriparser_parse, MRB_ARGS_REQ (1));
+  mrb_define_module_function_id (mrb, uriparser, MRB_SYM (parse_lazy),
+                                 mrb_uriparser_parse_lazy, MRB_ARGS_REQ (1));
+  mrb_define_module_function_id (
+      mrb, uriparser, MRB_SYM (filename_to_uri_string),
+      mrb_uriparser_filename_to_uri_string, MRB_ARGS_ANY ());
+  mrb_define_module_function_id (
+      mrb, uriparser, MRB_SYM (uri_string_to_filename),
+      mrb_uriparser_uri_string_to_filename, MRB_ARGS_ANY ());
+  mrb_define_module_function_id (mrb, uriparser, MRB_SYM (encode_www_form),
+                                 mrb_uriparser_compose_query,
+                                 MRB_ARGS_REQ (1));
+  mrb_define_module_function_id (mrb, uriparser, MRB_SYM (cache_key),
+                                 mrb_uriparser_cache_key_str,
+                                 MRB_ARGS_REQ (1) | MRB_ARGS_KEY (2, 0));
+  mrb_define_module_function_id (mrb, uriparser, MRB_SYM (parse_many),
+                                 mrb_uriparser_parse_many,
+                                 MRB_ARGS_REQ (1) | MRB_ARGS_KEY (1, 0));
+  mrb_define_module_function_id (mrb, uriparser, MRB_SYM (normalize_many),
+                                 mrb_uriparser_normalize_many,
+                                 MRB_ARGS_REQ (1) | MRB_ARGS_KEY (1, 0));
+  mrb_define_module_function_id (mrb, uriparser, MRB_SYM (load),
+                                 mrb_uriparser_load, MRB_ARGS_REQ (1));
+  mrb_define_module_function_id (mrb, uriparser, MRB_SYM (dump_all),
+                                 mrb_uriparser_dump_all, MRB_ARGS_REQ (1));
+  mrb_define_module_function_id (mrb, uriparser, MRB_SYM (load_all),
+                                 mrb_uriparser_load_all, MRB_ARGS_REQ (1));
+  struct RClass *const uri = mrb_define_class_under_id (
+      mrb, uriparser, MRB_SYM (URI), mrb->object_class);
+  MRB_SET_INSTANCE_TT (uri, MRB_TT_CDATA);
+  mrb_define_method_id (mrb, uri, MRB_SYM (initialize_copy),
+                        mrb_uriparser_initialize_copy, MRB_ARGS_REQ (1));
+  mrb_define_method_id (mrb, uri, MRB_OPSYM (eq), mrb_uriparser_equals,
+                        MRB_ARGS_REQ (1));
+  mrb_define_method_id (mrb, uri, MRB_SYM (scheme), mrb_uriparser_scheme,
+                        MRB_ARGS_NONE ());
+  mrb_define_method_id (mrb, uri, MRB_SYM_E (scheme), mrb_uriparser_set_Scheme,
+                        MRB_ARGS_REQ (1));
+  mrb_define_method_id (mrb, uri, MRB_SYM (userinfo), mrb_uriparser_userInfo,
+                        MRB_ARGS_NONE ());
+  mrb_define_method_id (mrb, uri, MRB_SYM_E (userinfo),
+                        mrb_uriparser_set_UserInfo, MRB_ARGS_REQ (1));
+  mrb_define_method_id (mrb, uri, MRB_SYM (hostname), mrb_uriparser_hostText,
+                        MRB_ARGS_NONE ());
+  mrb_define_method_id (mrb, uri, MRB_SYM_E (host), mrb_uriparser_set_HostAuto,
+                        MRB_ARGS_REQ (1));
+  mrb_define_method_id (mrb, uri, MRB_SYM_Q (host), mrb_uriparser_has_host,
+                        MRB_ARGS_NONE ());
+  mrb_define_method_id (mrb, uri, MRB_SYM (port), mrb_uriparser_portText,
+                        MRB_ARGS_NONE ());
+  mrb_define_method_id (mrb, uri, MRB_SYM_E (port), mrb_uriparser_set_PortText,
+                        MRB_ARGS_REQ (1));
+  mrb_define_method_id (mrb, uri, MRB_SYM (path_segments),
+                        mrb_uriparser_path_segments, MRB_ARGS_NONE ());
+  mrb_define_method_id (mrb, uri, MRB_SYM_E (path), mrb_uriparser_set_Path,
+                        MRB_ARGS_REQ (1));
+  mrb_define_method_id (mrb, uri, MRB_SYM (query), mrb_uriparser_query,
+                        MRB_ARGS_NONE ());
+  mrb_define_method_id (mrb, uri, MRB_SYM_E (query), mrb_uriparser_set_Query,
+                        MRB_ARGS_REQ (1));
+  mrb_define_method_id (mrb, uri, MRB_SYM (fragment), mrb_uriparser_fragment,
+                        MRB_ARGS_NONE ());
+  mrb_define_method_id (mrb, uri, MRB_SYM_E (fragment),
+                        mrb_uriparser_set_Fragment, MRB_ARGS_REQ (1));
+  mrb_define_method_id (mrb, uri, MRB_SYM_Q (absolute_path),
+                        mrb_uriparser_absolute_path, MRB_ARGS_NONE ());
+  mrb_define_method_id (mrb, uri, MRB_SYM (to_s), mrb_uriparser_recompose,
+                        MRB_ARGS_NONE ());
+  mrb_define_method_id (mrb, uri, MRB_SYM_B (merge),
+                        mrb_uriparser_merge_mutably, MRB_ARGS_REQ (1));
+  mrb_define_method_id (mrb, uri, MRB_SYM (merge), mrb_uriparser_merge,
+                        MRB_ARGS_REQ (1));
+  mrb_define_method_id (mrb, uri, MRB_SYM (route_from),
+                        mrb_uriparser_create_reference, MRB_ARGS_ANY ());
+  mrb_define_method_id (mrb, uri, MRB_SYM (route_all),
+                        mrb_uriparser_route_all,
+                        MRB_ARGS_REQ (1) | MRB_ARGS_KEY (2, 0));
+  mrb_define_method_id (mrb, uri, MRB_SYM_B (normalize),
+                        mrb_uriparser_normalize, MRB_ARGS_KEY (6, 0));
+  mrb_define_method_id (mrb, uri, MRB_SYM (decode_www_form),
+                        mrb_uriparser_dissect_query, MRB_ARGS_NONE ());
+  mrb_define_method_id (mrb, uri, MRB_SYM (set_query_param),
+                        mrb_uriparser_set_query_param, MRB_ARGS_REQ (2));
+  mrb_define_method_id (mrb, uri, MRB_SYM (delete_query_params),
+                        mrb_uriparser_delete_query_params, MRB_ARGS_REST ());
+  mrb_define_method_id (mrb, uri, MRB_SYM (filter_query),
+                        mrb_uriparser_filter_query, MRB_ARGS_BLOCK ());
+  mrb_define_method_id (mrb, uri, MRB_SYM (cache_key),
+                        mrb_uriparser_cache_key, MRB_ARGS_KEY (2, 0));
+  mrb_define_method_id (mrb, uri, MRB_SYM_Q (parsed), mrb_uriparser_parsed,
+                        MRB_ARGS_NONE ());
+  mrb_define_method_id (mrb, uri, MRB_SYM_Q (valid), mrb_uriparser_valid,
+                        MRB_ARGS_NONE ());
+  mrb_define_method_id (mrb, uri, MRB_SYM (memsize), mrb_uriparser_memsize,
+                        MRB_ARGS_NONE ());
+  mrb_define_method_id (mrb, uri, MRB_SYM (dump), mrb_uriparser_dump,
+                        MRB_ARGS_NONE ());
   DONE;
 }
 
@@ -230,3 +230,303 @@ assert("URIParser::URI#path") do
   assert_equal("//", URIParser.parse("http://example.com//").path)
   assert_equal("/./..", URIParser.parse("http://example.com/./..").path)
 end
+
+assert("URIParser::URI#dump") do
+  ["s://u:p@h:0/p?q#f",
+   "http://example.com",
+   "http://example.com/",
+   "http://example.com/abc/def/?",
+   "http://192.168.0.1:8080/a",
+   "http://[::1]/bar",
+   "http://[v7.fe]/",
+   "mailto:someone@example.com",
+   "/abs/path",
+   "rel/path#frag",
+   ""].each do |source|
+    uri = URIParser.parse(source)
+    loaded = URIParser::URI.load(uri.dump)
+    assert_kind_of(URIParser::URI, loaded)
+    assert_equal(uri.to_s, loaded.to_s)
+    assert_true(uri == loaded)
+    assert_equal(uri.path_segments, loaded.path_segments)
+    assert_equal(uri.hostname, loaded.hostname)
+    assert_equal(uri.absolute_path?, loaded.absolute_path?)
+  end
+
+  loaded = URIParser.load(URIParser.parse("http://example.com/a").dump)
+  loaded.scheme = "https"
+  loaded.path = "/b/c"
+  assert_equal("https://example.com/b/c", loaded.to_s)
+  assert_equal("http://example.com/d",
+               (loaded + URIParser.parse("http://example.com/d")).to_s)
+
+  assert_raise_with_message(URIParser::Error, "invalid URI dump") do
+    URIParser::URI.load("http://example.com")
+  end
+  assert_raise_with_message(URIParser::Error, "invalid URI dump") do
+    URIParser::URI.load(URIParser.parse("http://example.com").dump[0..-2])
+  end
+end
+
+assert("URIParser.dump_all") do
+  sources = ["http://example.com/a?b#c", "../d", "file:///e/f"]
+  loaded = URIParser.load_all(URIParser.dump_all(sources.map { |s| URIParser.parse(s) }))
+  assert_equal(sources, loaded.map { |uri| uri.to_s })
+  assert_equal([], URIParser.load_all(URIParser.dump_all([])))
+
+  assert_raise_with_message(URIParser::Error, "URI is expected to be URIParser::URI") do
+    URIParser.dump_all(["http://example.com"])
+  end
+  assert_raise_with_message(URIParser::Error, "invalid URI dump") do
+    URIParser.load_all(URIParser.parse("http://example.com").dump)
+  end
+end
+
+assert("URIParser::URI#set_query_param") do
+  uri = URIParser.parse("http://example.com/?a=1&b=%41+x&a=2#f")
+  assert_same(uri, uri.set_query_param("a", "x y"))
+  assert_equal("http://example.com/?a=x+y&b=%41+x#f", uri.to_s)
+
+  uri.set_query_param("b x", nil)
+  assert_equal("http://example.com/?a=x+y&b=%41+x&b+x#f", uri.to_s)
+
+  uri.set_query_param("bA x", "")
+  assert_equal("http://example.com/?a=x+y&b=%41+x&b+x&bA+x=#f", uri.to_s)
+
+  uri = URIParser.parse("http://example.com")
+  uri.set_query_param("sig", "abc")
+  assert_equal("http://example.com?sig=abc", uri.to_s)
+end
+
+assert("URIParser::URI#delete_query_params") do
+  uri = URIParser.parse("http://example.com/?utm_source=x&id=1&utm_medium=y&%69d=2&ref")
+  matcher = Object.new
+  def matcher.===(key)
+    key[0, 4] == "utm_"
+  end
+  assert_same(uri, uri.delete_query_params(matcher, "ref"))
+  assert_equal("http://example.com/?id=1&%69d=2", uri.to_s)
+
+  uri.delete_query_params("id")
+  assert_equal("http://example.com/", uri.to_s)
+  assert_nil(uri.query)
+
+  uri = URIParser.parse("http://example.com/")
+  uri.delete_query_params("id")
+  assert_equal("http://example.com/", uri.to_s)
+end
+
+assert("URIParser::URI#filter_query") do
+  uri = URIParser.parse("http://example.com/?a=1&b=x+y&c&a=%32")
+  pairs = []
+  result = uri.filter_query do |key, value|
+    pairs << [key, value]
+    key == "a"
+  end
+  assert_same(uri, result)
+  assert_equal([["a", "1"], ["b", "x y"], ["c", nil], ["a", "2"]], pairs)
+  assert_equal("http://example.com/?a=1&a=%32", uri.to_s)
+
+  uri.filter_query { |key, value| false }
+  assert_equal("http://example.com/", uri.to_s)
+end
+
+assert("URIParser::URI#cache_key") do
+  source = "HTTP://Example.COM:80/a/./b/../c?b=2&utm=x&a=1#frag"
+  uri = URIParser.parse(source)
+  assert_equal("http://example.com/a/c?a=1&b=2&utm=x", uri.cache_key)
+  assert_equal("http://example.com/a/c?a=1&b=2",
+               uri.cache_key(ignore_params: ["utm"]))
+  assert_equal("http://example.com/a/c?b=2&a=1",
+               uri.cache_key(ignore_params: ["utm"], sort_query: false))
+  assert_equal(source, uri.to_s)
+
+  assert_equal("http://example.com/x?a&b",
+               URIParser.parse("http://example.com/x?b&a").cache_key)
+  assert_equal("https://example.com:8443/",
+               URIParser.parse("https://example.com:8443").cache_key)
+  assert_equal("http://example.com/?a=1",
+               URIParser.parse("http://example.com?a=1&%75tm=2").cache_key(ignore_params: ["utm"]))
+
+  assert_raise(TypeError) do
+    uri.cache_key(ignore_params: [:utm])
+  end
+end
+
+assert("URIParser.cache_key") do
+  assert_equal("https://example.com/",
+               URIParser.cache_key("https://EXAMPLE.com:443?#top"))
+  assert_equal("http://example.com/p?a=1&c=3",
+               URIParser.cache_key("http://example.com/p?c=3&b=2&a=1",
+                                   ignore_params: ["b"]))
+end
+
+assert("URIParser.parse_lazy") do
+  source = "http://example.com/a/b?q#f"
+  uri = URIParser.parse_lazy(source)
+  assert_kind_of(URIParser::URI, uri)
+  assert_false(uri.parsed?)
+  assert_equal(source, uri.to_s)
+  assert_false(uri.parsed?)
+
+  copy = uri.dup
+  assert_false(copy.parsed?)
+  assert_equal(source, copy.to_s)
+
+  assert_equal("example.com", uri.hostname)
+  assert_true(uri.parsed?)
+  assert_equal(["a", "b"], uri.path_segments)
+  assert_false(copy.parsed?)
+  assert_true(uri == copy)
+
+  uri = URIParser::URI.parse_lazy("http://example.com/a/b")
+  uri.scheme = "https"
+  assert_equal("https://example.com/a/b", uri.to_s)
+
+  uri = URIParser.parse_lazy("http://example.com/one/two/../three")
+  uri.normalize!
+  assert_equal("http://example.com/one/three", uri.to_s)
+
+  base = URIParser.parse_lazy("http://example.com/a/b")
+  assert_equal("http://example.com/a/c", base.merge(URIParser.parse_lazy("c")).to_s)
+  assert_equal("foo/bar.html",
+               URIParser.parse_lazy("http://example.com/foo/bar.html")
+                 .route_from(URIParser.parse_lazy("http://example.com/")).to_s)
+
+  uri = URIParser.parse_lazy("foo bar")
+  assert_equal("foo bar", uri.to_s)
+  assert_raise_with_message(URIParser::Error, "URI parse failed at: ` bar'") do
+    uri.scheme
+  end
+end
+
+assert("URIParser::URI#valid?") do
+  uri = URIParser.parse_lazy("http://example.com")
+  assert_true(uri.valid?)
+  assert_true(uri.parsed?)
+
+  uri = URIParser.parse_lazy("foo bar")
+  assert_false(uri.valid?)
+  assert_false(uri.parsed?)
+
+  assert_true(URIParser.parse("http://example.com").valid?)
+end
+
+assert("URIParser.parse_many") do
+  strs = ["http://example.com/a?q#f", "../b", "", "mailto:x@example.com"] * 5
+  [1, 3, 100].each do |threads|
+    uris = URIParser.parse_many(strs, threads:)
+    assert_equal(strs.size, uris.size)
+    strs.each_with_index do |str, i|
+      assert_kind_of(URIParser::URI, uris[i])
+      assert_true(URIParser.parse(str) == uris[i])
+      assert_equal(URIParser.parse(str).to_s, uris[i].to_s)
+    end
+  end
+  assert_equal([], URIParser.parse_many([], threads: 4))
+
+  # Large enough to be split across threads.
+  strs = Array.new(1024) { |i| "http://example.com/#{i}?q=#{i}" }
+  uris = URIParser.parse_many(strs, threads: 4)
+  assert_equal(strs, uris.map { |uri| uri.to_s })
+
+  assert_raise_with_message(URIParser::Error, "URI parse failed at: ` bar'") do
+    URIParser.parse_many(["http://example.com", "foo bar", "baz qux"], threads: 2)
+  end
+  assert_raise(TypeError) { URIParser.parse_many([1]) }
+  assert_raise(ArgumentError) { URIParser.parse_many(["a"], threads: 0) }
+end
+
+assert("URIParser.normalize_many") do
+  strs = ["HTTP://Example.COM/one/two/../../one", "http://example.org/%7e"] * 3
+  expected = strs.map do |str|
+    uri = URIParser.parse(str)
+    uri.normalize!
+    uri.to_s
+  end
+  [1, 2, 4].each do |threads|
+    assert_equal(expected, URIParser.normalize_many(strs, threads:))
+  end
+
+  strs = Array.new(1024) { |i| "HTTP://Example.COM/a/../#{i}" }
+  expected = Array.new(1024) { |i| "http://example.com/#{i}" }
+  assert_equal(expected, URIParser.normalize_many(strs, threads: 4))
+
+  assert_raise_with_message(URIParser::Error, "URI parse failed at: ` bar'") do
+    URIParser.normalize_many(["foo bar"], threads: 2)
+  end
+end
+
+assert("URIParser::URI#memsize") do
+  lazy = URIParser.parse_lazy("http://example.com/a/b")
+  unparsed = lazy.memsize
+  assert_true(unparsed > "http://example.com/a/b".size)
+  lazy.scheme
+  assert_true(lazy.memsize > unparsed)
+
+  base = URIParser.parse("http://example.com/a/b")
+  merged = base.merge(URIParser.parse("../c"))
+  assert_equal("http://example.com/c", merged.to_s)
+  assert_true(merged.memsize > 0)
+end
+
+assert("URIParser::URI lifecycle") do
+  assert_raise_with_message(URIParser::Error, "uninitialized URI") do
+    URIParser::URI.new.scheme
+  end
+  assert_false(URIParser.parse("http://example.com") == "http://example.com")
+
+  uri = URIParser.parse("http://example.com/self")
+  uri.send(:initialize_copy, uri)
+  assert_equal("http://example.com/self", uri.to_s)
+  lazy = URIParser.parse_lazy("http://example.com/lazy")
+  lazy.send(:initialize_copy, uri)
+  assert_true(lazy.parsed?)
+  assert_equal("http://example.com/self", lazy.to_s)
+
+  uri = URIParser.parse("http://example.com/a?b=c")
+  copy = uri.dup
+  uri = nil
+  GC.start
+  assert_equal("http://example.com/a?b=c", copy.to_s)
+
+  base = URIParser.parse("http://example.com/a/")
+  merged = base.merge(URIParser.parse("b/c"))
+  GC.start
+  assert_equal("http://example.com/a/b/c", merged.to_s)
+  assert_equal("b/c", merged.route_from(base).to_s)
+end
+
+assert("URIParser::URI#route_all") do
+  base = URIParser.parse("http://example.com/a/b/")
+  strs = ["http://example.com/a/b/c", "http://example.com/a/d?q=1#f",
+          "http://example.com/x/y", "http://example.org/a/b/c"]
+  targets = strs.map { |str| URIParser.parse(str) }
+  expected = targets.map { |target| target.route_from(base).to_s }
+  assert_equal("c", expected[0])
+  assert_equal(expected, base.route_all(strs))
+  assert_equal(expected, base.route_all(targets))
+  assert_equal(expected, base.route_all(strs, as: :string))
+
+  routed = base.route_all([strs[0], targets[2]], as: :uri)
+  assert_kind_of(URIParser::URI, routed[0])
+  assert_true(targets[0].route_from(base) == routed[0])
+  assert_equal(expected[2], routed[1].to_s)
+
+  expected = targets.map do |target|
+    target.route_from(base, domain_root: true).to_s
+  end
+  assert_equal(expected, base.route_all(strs, domain_root: true))
+  assert_equal([], base.route_all([]))
+
+  # References longer than the output buffer so far.
+  strs = [10, 100, 1000, 20].map { |n| "http://example.com/a/b/#{"x" * n}?q" }
+  expected = strs.map { |str| URIParser.parse(str).route_from(base).to_s }
+  assert_equal(expected, base.route_all(strs))
+
+  assert_raise_with_message(URIParser::Error, "URI parse failed at: ` bar'") do
+    base.route_all(["foo bar"])
+  end
+  assert_raise(URIParser::Error) { base.route_all([1]) }
+  assert_raise(ArgumentError) { base.route_all(strs, as: :foo) }
+end